@@ -114,9 +114,15 @@ using void_t = typename make_void<Ts...>::type;
 } // namespace alia
 
 
+#include <cstddef>
 #include <functional>
 #include <memory>
+#include <new>
 #include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 // This file implements the concept of IDs in alia.
 
@@ -147,7 +153,102 @@ struct id_interface
     // one.
     virtual bool
     less_than(id_interface const& other) const = 0;
+
+    // Return a hash of the ID. IDs that are equal must have equal hashes.
+    // (IDs of different types are allowed to collide.)
+    virtual std::size_t
+    hash() const = 0;
+
+    // Construct a standalone copy of the ID in :buffer (which has room for
+    // :size bytes and is aligned to id_buffer_alignment) and return a pointer
+    // to it. If the ID doesn't fit (or its type doesn't support this), return
+    // nullptr instead, and the caller will fall back to clone().
+    //
+    // This is what allows captured_id to store small IDs without allocating.
+    virtual id_interface*
+    clone_in_place(void*, std::size_t) const
+    {
+        return nullptr;
+    }
+
+    // Same, but the ID (which is itself standalone) is moved into :buffer
+    // rather than copied, and it's left in a valid but unspecified state.
+    virtual id_interface*
+    move_in_place(void* buffer, std::size_t size)
+    {
+        return this->clone_in_place(buffer, size);
+    }
+};
+
+// the alignment of the buffers that IDs are cloned into by clone_in_place()
+std::size_t const id_buffer_alignment = alignof(void*);
+
+// clone_id_in_place(id, buffer, size) implements clone_in_place for IDs that
+// can be default-constructed and then deep-copied into.
+template<class Id>
+id_interface*
+clone_id_in_place(Id const& id, void* buffer, std::size_t size)
+{
+    if (sizeof(Id) > size || alignof(Id) > id_buffer_alignment)
+        return nullptr;
+    Id* copy = new (buffer) Id;
+    id.deep_copy(copy);
+    return copy;
+}
+
+// move_id_in_place(id, buffer, size) implements move_in_place for IDs that can
+// be move-constructed.
+template<class Id>
+id_interface*
+move_id_in_place(Id& id, void* buffer, std::size_t size)
+{
+    if (sizeof(Id) > size || alignof(Id) > id_buffer_alignment)
+        return nullptr;
+    return new (buffer) Id(std::move(id));
+}
+
+// combine_hashes(a, b) combines two hash values into one.
+inline std::size_t
+combine_hashes(std::size_t a, std::size_t b)
+{
+    return a ^ (b + 0x9e3779b9 + (a << 6) + (a >> 2));
+}
+
+// hash_id_value(value) hashes a value that's used as (part of) an ID.
+// If std::hash is available for the value's type, it's used. Otherwise, all
+// values hash to the same thing (which is correct but makes hashed lookups of
+// those IDs degrade to linear searches).
+template<class Value, class = void>
+struct id_value_hasher
+{
+    // Does this actually hash the value?
+    static bool const hashes_content = false;
+
+    std::size_t
+    operator()(Value const&) const
+    {
+        return 0;
+    }
+};
+template<class Value>
+struct id_value_hasher<
+    Value,
+    void_t<decltype(std::hash<Value>()(std::declval<Value const&>()))>>
+{
+    static bool const hashes_content = true;
+
+    std::size_t
+    operator()(Value const& value) const
+    {
+        return std::hash<Value>()(value);
+    }
 };
+template<class Value>
+std::size_t
+hash_id_value(Value const& value)
+{
+    return id_value_hasher<Value>()(value);
+}
 
 // The following convert the interface of the ID operations into the usual form
 // that one would expect, as free functions.
@@ -196,6 +297,12 @@ clone_into(std::shared_ptr<id_interface>& storage, id_interface const* id);
 
 // captured_id is used to capture an ID for long-term storage (beyond the point
 // where the id_interface reference will be valid).
+//
+// Small IDs (e.g., simple IDs of integers or pointers, pairs of those, and
+// hashed_ids) are stored inline, so capturing them never allocates. Larger IDs
+// are cloned onto the heap. Recapturing an ID of the same type as the one
+// that's already captured never allocates either, since it's copied into the
+// existing one.
 struct captured_id
 {
     captured_id()
@@ -212,33 +319,38 @@ struct captured_id
     }
     captured_id(captured_id&& other)
     {
-        id_ = std::move(other.id_);
+        this->take(other);
+    }
+    ~captured_id()
+    {
+        this->clear();
     }
     captured_id&
     operator=(captured_id const& other)
     {
-        if (other.is_initialized())
-            this->capture(other.get());
-        else
-            this->clear();
+        if (this != &other)
+        {
+            if (other.is_initialized())
+                this->capture(other.get());
+            else
+                this->clear();
+        }
         return *this;
     }
     captured_id&
     operator=(captured_id&& other)
     {
-        id_ = std::move(other.id_);
+        if (this != &other)
+        {
+            this->clear();
+            this->take(other);
+        }
         return *this;
     }
     void
-    clear()
-    {
-        id_.reset();
-    }
+    clear();
     void
-    capture(id_interface const& new_id)
-    {
-        clone_into(id_, &new_id);
-    }
+    capture(id_interface const& new_id);
     bool
     is_initialized() const
     {
@@ -257,11 +369,33 @@ struct captured_id
     friend void
     swap(captured_id& a, captured_id& b)
     {
-        swap(a.id_, b.id_);
+        captured_id tmp(std::move(a));
+        a = std::move(b);
+        b = std::move(tmp);
     }
 
+    // the number of bytes available for storing IDs inline - This is sized
+    // for a pair of simple IDs of integers or pointers (40 bytes on 64-bit
+    // platforms), which is the largest of the common cases. Simple IDs
+    // themselves take 16 bytes, and hashed_ids take 32.
+    static std::size_t const inline_capacity = 5 * sizeof(void*);
+
  private:
-    std::shared_ptr<id_interface> id_;
+    // Move :other's ID into this (which must be empty) and leave :other empty.
+    void
+    take(captured_id& other);
+
+    // Is id_ stored in buffer_ (rather than on the heap)?
+    bool
+    is_inline() const
+    {
+        char const* id = reinterpret_cast<char const*>(id_);
+        char const* buffer = reinterpret_cast<char const*>(&buffer_);
+        return id >= buffer && id < buffer + inline_capacity;
+    }
+
+    id_interface* id_ = nullptr;
+    std::aligned_storage_t<inline_capacity, id_buffer_alignment> buffer_;
 };
 bool
 operator==(captured_id const& a, captured_id const& b);
@@ -271,14 +405,34 @@ bool
 operator<(captured_id const& a, captured_id const& b);
 
 // ref(id) wraps a reference to an id_interface so that it can be combined.
+//
+// When an id_ref is captured, the copy holds a clone of the referenced ID in
+// its own captured_id, so small referenced IDs are stored inline, and
+// recapturing one of the same type doesn't allocate.
 struct id_ref : id_interface
 {
-    id_ref() : id_(0), ownership_()
+    id_ref() : id_(nullptr)
+    {
+    }
+
+    id_ref(id_interface const& id) : id_(&id)
+    {
+    }
+
+    id_ref(id_ref const& other) : owned_(other.owned_)
     {
+        id_ = owned_.is_initialized() ? &owned_.get() : other.id_;
     }
 
-    id_ref(id_interface const& id) : id_(&id), ownership_()
+    id_ref&
+    operator=(id_ref const& other)
     {
+        if (this != &other)
+        {
+            owned_ = other.owned_;
+            id_ = owned_.is_initialized() ? &owned_.get() : other.id_;
+        }
+        return *this;
     }
 
     id_interface*
@@ -303,25 +457,24 @@ struct id_ref : id_interface
         return *id_ < *other_id.id_;
     }
 
+    std::size_t
+    hash() const
+    {
+        return id_->hash();
+    }
+
     void
     deep_copy(id_interface* copy) const
     {
         auto& typed_copy = *static_cast<id_ref*>(copy);
-        if (ownership_)
-        {
-            typed_copy.ownership_ = ownership_;
-            typed_copy.id_ = id_;
-        }
-        else
-        {
-            typed_copy.ownership_.reset(id_->clone());
-            typed_copy.id_ = typed_copy.ownership_.get();
-        }
+        typed_copy.owned_.capture(*id_);
+        typed_copy.id_ = &typed_copy.owned_.get();
     }
 
  private:
+    // If this is a standalone copy, :owned_ holds the referenced ID.
+    captured_id owned_;
     id_interface const* id_;
-    std::shared_ptr<id_interface> ownership_;
 };
 inline id_ref
 ref(id_interface const& id)
@@ -356,6 +509,23 @@ struct simple_id : id_interface
         return new simple_id(value_);
     }
 
+    id_interface*
+    clone_in_place(void* buffer, std::size_t size) const
+    {
+        if (sizeof(simple_id) > size
+            || alignof(simple_id) > id_buffer_alignment)
+        {
+            return nullptr;
+        }
+        return new (buffer) simple_id(value_);
+    }
+
+    id_interface*
+    move_in_place(void* buffer, std::size_t size)
+    {
+        return move_id_in_place(*this, buffer, size);
+    }
+
     bool
     equals(id_interface const& other) const
     {
@@ -370,6 +540,12 @@ struct simple_id : id_interface
         return value_ < other_id.value_;
     }
 
+    std::size_t
+    hash() const
+    {
+        return hash_id_value(value_);
+    }
+
     void
     deep_copy(id_interface* copy) const
     {
@@ -425,6 +601,12 @@ struct simple_id_by_reference : id_interface
         return *value_ < *other_id.value_;
     }
 
+    std::size_t
+    hash() const
+    {
+        return hash_id_value(*value_);
+    }
+
     void
     deep_copy(id_interface* copy) const
     {
@@ -454,6 +636,175 @@ make_id_by_reference(Value const& value)
     return simple_id_by_reference<Value>(&value);
 }
 
+// hash_id_content(value) computes the content hash used by hashed_id.
+template<class Value>
+std::size_t
+hash_id_content(Value const& value)
+{
+    return hash_id_value(value);
+}
+template<class Item, class Allocator>
+std::size_t
+hash_id_content(std::vector<Item, Allocator> const& value)
+{
+    std::size_t hash = value.size();
+    for (auto const& item : value)
+        hash = combine_hashes(hash, hash_id_content(item));
+    return hash;
+}
+
+// is_id_content_hashable<Value>::value is true iff hash_id_content() actually
+// hashes the content of values of type Value. (For other types, it gives the
+// same hash for all values.)
+template<class Value>
+struct is_id_content_hashable
+    : std::integral_constant<bool, id_value_hasher<Value>::hashes_content>
+{
+};
+template<class Item, class Allocator>
+struct is_id_content_hashable<std::vector<Item, Allocator>>
+    : is_id_content_hashable<Item>
+{
+};
+
+// get_id_content_size(value) gives a size to accompany the content hash, to
+// make collisions even less likely.
+template<class Value>
+std::size_t
+get_id_content_size(Value const&)
+{
+    return 0;
+}
+template<class Char, class Traits, class Allocator>
+std::size_t
+get_id_content_size(std::basic_string<Char, Traits, Allocator> const& value)
+{
+    return value.size();
+}
+template<class Item, class Allocator>
+std::size_t
+get_id_content_size(std::vector<Item, Allocator> const& value)
+{
+    return value.size();
+}
+
+// make_unique_content_hash() gives a hash that's distinct from all others that
+// it has given. This stands in for the content hash of values that can't be
+// hashed.
+std::size_t
+make_unique_content_hash();
+
+// hashed_id<Value> identifies a value of type Value by a hash of its content
+// (along with its size) or by a version number supplied by whoever owns the
+// value. This is intended for large values, where simple_id_by_reference would
+// have to copy the entire value whenever the ID is captured and deep-compare
+// it whenever it's tested.
+//
+// The ID consists only of the hash, size and version, so copying, capturing,
+// testing and ordering it are all O(1) and never allocate beyond the ID
+// itself. Two IDs are equal iff all three match, so values with the same
+// (64-bit) hash and size are treated as the same. Only make_hashed_id() looks
+// at the value, so callers that want to avoid rehashing an unchanged value can
+// cache its hash and construct the ID from that. (See identify_by_hash().)
+//
+// If a (nonzero) version is supplied, it's taken as the identity of the
+// content and no hashing is done at all.
+//
+// If the content of Value can't be hashed (see is_id_content_hashable), an
+// unversioned ID gets a unique hash instead, so it only ever matches its own
+// copies, and whatever depends on it is always treated as changed.
+// (identify_by_hash() refuses such types outright.)
+template<class Value>
+struct hashed_id : id_interface
+{
+    hashed_id() : hash_(0), size_(0), version_(0)
+    {
+    }
+
+    hashed_id(std::size_t hash, std::size_t size, counter_type version)
+        : hash_(hash), size_(size), version_(version)
+    {
+    }
+
+    id_interface*
+    clone() const
+    {
+        hashed_id* copy = new hashed_id;
+        this->deep_copy(copy);
+        return copy;
+    }
+
+    id_interface*
+    clone_in_place(void* buffer, std::size_t size) const
+    {
+        return clone_id_in_place(*this, buffer, size);
+    }
+
+    id_interface*
+    move_in_place(void* buffer, std::size_t size)
+    {
+        return move_id_in_place(*this, buffer, size);
+    }
+
+    bool
+    equals(id_interface const& other) const
+    {
+        hashed_id const& other_id = static_cast<hashed_id const&>(other);
+        return version_ == other_id.version_ && hash_ == other_id.hash_
+               && size_ == other_id.size_;
+    }
+
+    bool
+    less_than(id_interface const& other) const
+    {
+        hashed_id const& other_id = static_cast<hashed_id const&>(other);
+        if (version_ != other_id.version_)
+            return version_ < other_id.version_;
+        if (hash_ != other_id.hash_)
+            return hash_ < other_id.hash_;
+        return size_ < other_id.size_;
+    }
+
+    std::size_t
+    hash() const
+    {
+        return combine_hashes(hash_, std::size_t(version_));
+    }
+
+    void
+    deep_copy(id_interface* copy) const
+    {
+        *static_cast<hashed_id*>(copy) = *this;
+    }
+
+ private:
+    std::size_t hash_;
+    std::size_t size_;
+    counter_type version_;
+};
+
+// get_id_content_hash(value) gives the hash that an unversioned hashed_id uses
+// for :value.
+template<class Value>
+std::size_t
+get_id_content_hash(Value const& value)
+{
+    return is_id_content_hashable<Value>::value ? hash_id_content(value)
+                                                : make_unique_content_hash();
+}
+
+// make_hashed_id(value, version) creates a hashed_id for :value. If :version
+// is 0, this hashes :value.
+template<class Value>
+hashed_id<Value>
+make_hashed_id(Value const& value, counter_type version = 0)
+{
+    return hashed_id<Value>(
+        version != 0 ? 0 : get_id_content_hash(value),
+        get_id_content_size(value),
+        version);
+}
+
 // id_pair implements the ID interface for a pair of IDs.
 template<class Id0, class Id1>
 struct id_pair : id_interface
@@ -474,6 +825,18 @@ struct id_pair : id_interface
         return copy;
     }
 
+    id_interface*
+    clone_in_place(void* buffer, std::size_t size) const
+    {
+        return clone_id_in_place(*this, buffer, size);
+    }
+
+    id_interface*
+    move_in_place(void* buffer, std::size_t size)
+    {
+        return move_id_in_place(*this, buffer, size);
+    }
+
     bool
     equals(id_interface const& other) const
     {
@@ -489,6 +852,12 @@ struct id_pair : id_interface
                || (id0_.equals(other_id.id0_) && id1_.less_than(other_id.id1_));
     }
 
+    std::size_t
+    hash() const
+    {
+        return combine_hashes(id0_.hash(), id1_.hash());
+    }
+
     void
     deep_copy(id_interface* copy) const
     {
@@ -616,6 +985,22 @@ namespace alia {
         typedef data data_type;                                                \
     };
 
+// ALIA_DEFINE_SLOTTED_COMPONENT_TYPE(tag, data, slot) is like
+// ALIA_DEFINE_COMPONENT_TYPE, but it also assigns the component a fixed slot
+// index. Storage types that provide slots (like context_component_storage)
+// store the component in that slot, so retrieving it is a single load rather
+// than a lookup. :data must be a reference type.
+//
+// Slots are a per-application resource: Components that are used together
+// must be assigned distinct slots.
+//
+#define ALIA_DEFINE_SLOTTED_COMPONENT_TYPE(tag, data, slot_index)              \
+    struct tag                                                                 \
+    {                                                                          \
+        typedef data data_type;                                                \
+        static constexpr std::size_t slot = slot_index;                        \
+    };
+
 template<class Tags, class Storage>
 struct component_collection;
 
@@ -1220,7 +1605,25 @@ struct component_caster<any_ref, T&>
 // component storage structures with direct storage of frequently used
 // components. See context.hpp for an example of how it's used.
 
+// component_has_slot<Storage,Tag>::value yields a compile-time boolean
+// indicating whether or not :Tag was assigned a slot (via
+// ALIA_DEFINE_SLOTTED_COMPONENT_TYPE) and :Storage provides slots (via a
+// static slot_count and an array of void pointers called slots).
+template<class Storage, class Tag, class = void>
+struct component_has_slot : std::false_type
+{
+};
 template<class Storage, class Tag>
+struct component_has_slot<
+    Storage,
+    Tag,
+    void_t<decltype(Tag::slot), decltype(Storage::slot_count)>>
+    : std::true_type
+{
+};
+
+// By default, components are stored in the storage's generic container.
+template<class Storage, class Tag, class = void>
 struct component_accessor
 {
     static bool
@@ -1245,6 +1648,43 @@ struct component_accessor
     }
 };
 
+// Components with slots are stored in their slots.
+template<class Storage, class Tag>
+struct component_accessor<
+    Storage,
+    Tag,
+    std::enable_if_t<component_has_slot<Storage, Tag>::value>>
+{
+    typedef typename Tag::data_type data_type;
+    static_assert(
+        std::is_reference<data_type>::value,
+        "slotted components must be references");
+    static_assert(
+        Tag::slot < Storage::slot_count, "component slot is out of range");
+
+    static bool
+    has(Storage const& storage)
+    {
+        return storage.slots[Tag::slot] != nullptr;
+    }
+    static void
+    add(Storage& storage, data_type data)
+    {
+        storage.slots[Tag::slot] = &data;
+    }
+    static void
+    remove(Storage& storage)
+    {
+        storage.slots[Tag::slot] = nullptr;
+    }
+    static data_type
+    get(Storage& storage)
+    {
+        return *static_cast<std::remove_reference_t<data_type>*>(
+            storage.slots[Tag::slot]);
+    }
+};
+
 #define ALIA_IMPLEMENT_STORAGE_COMPONENT_ACCESSORS(Storage)                    \
     template<class Tag>                                                        \
     bool has() const                                                           \
@@ -1434,6 +1874,15 @@ struct signal_interface : untyped_signal_base
     // Write the signal's value.
     virtual void
     write(Value const& value) const = 0;
+
+    // Write the signal's value, taking ownership of :value. By default, this
+    // just copies it in through write(), but signals that store their values
+    // can override it to avoid the copy.
+    virtual void
+    move_in(Value&& value) const
+    {
+        this->write(value);
+    }
 };
 
 template<class Derived, class Value, class Direction>
@@ -1548,6 +1997,11 @@ struct signal_ref : signal<signal_ref<Value, Direction>, Value, Direction>
     {
         ref_->write(value);
     }
+    void
+    move_in(Value&& value) const
+    {
+        ref_->move_in(std::move(value));
+    }
 
  private:
     signal_interface<Value> const* ref_;
@@ -1658,6 +2112,17 @@ write_signal(Signal const& signal, Value const& value)
     if (signal.ready_to_write())
         signal.write(value);
 }
+// When given an rvalue of the signal's own type, write_signal lets the signal
+// take ownership of it (rather than copying it).
+template<class Signal, class Value>
+std::enable_if_t<
+    signal_is_writable<Signal>::value && !std::is_reference<Value>::value
+    && std::is_same<Value, typename Signal::value_type>::value>
+write_signal(Signal const& signal, Value&& value)
+{
+    if (signal.ready_to_write())
+        signal.move_in(std::move(value));
+}
 
 // signal_is_bidirectional<Signal>::value yields a compile-time boolean
 // indicating whether or not the given signal type supports both reading and
@@ -2083,6 +2548,10 @@ struct context_component_storage
     data_traversal* data = nullptr;
     timing_component* timing = nullptr;
 
+    // slots for components defined with ALIA_DEFINE_SLOTTED_COMPONENT_TYPE
+    static constexpr std::size_t slot_count = 8;
+    void* slots[slot_count] = {};
+
     // generic storage for other components
     generic_component_storage<any_ref> generic;
 
@@ -2205,25 +2674,188 @@ get_raw_animation_ticks_left(dataless_context ctx, millisecond_count end_tick);
 } // namespace alia
 
 
-#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
 
-// This file defines the data retrieval library used for associating mutable
-// state and cached data with alia content graphs. It is designed so that each
-// node emitted by an application is associated with a unique instance of data,
-// even if there is no specific external identifier for that node.
-//
-// More generally, if you replace "node" with "subexpression evaluation" in the
-// previous sentence, it can be used to associate data with particular points in
-// the evaluation of any function. This can be useful in situations where you
-// need to evaluate a particular function many times with slightly different
-// inputs and you want to reuse the work that was done in earlier evaluations
-// without a lot of manual bookkeeping.
+// This file provides an opt-in profiler for alia traversals. When a
+// traversal_profiler is attached to a system (via sys.profiler), traversals
+// count the data graph work that they do (see profiling_counters), and timed
+// spans are recorded for each traversal and for any scoped_profiling_span
+// within it. The spans can be exported in the Chrome trace event format,
+// which Perfetto and chrome://tracing can both load.
 //
-// To understand what's going on here, imagine the evaluation of a function on
-// a simple in-order, single-threaded processor. We can represent all possible
-// execution flows using a single DAG where each node represents the execution
-// of a particular instruction by the processor and edges represent the
-// transition to the next instruction. Nodes with multiple edges leaving them
+// When no profiler is attached, the instrumentation only costs a null check.
+
+namespace alia {
+
+// profiling_counters counts the work done during a traversal (or part of
+// one).
+struct profiling_counters
+{
+    // data nodes retrieved (via get_data() and everything built on it)
+    std::size_t data_nodes = 0;
+    // data nodes that had to be created (i.e., cache misses)
+    std::size_t new_data_nodes = 0;
+    // data blocks activated (including named blocks)
+    std::size_t data_blocks = 0;
+    // named blocks found where they were predicted to be
+    std::size_t predicted_named_blocks = 0;
+    // named blocks that had to be looked up in their naming maps
+    std::size_t mapped_named_blocks = 0;
+    // named blocks that had to be created
+    std::size_t new_named_blocks = 0;
+    // updates of nodes in the external UI tree (e.g., Qt layout nodes) - This
+    // is counted by the external library.
+    std::size_t layout_updates = 0;
+};
+
+profiling_counters&
+operator+=(profiling_counters& a, profiling_counters const& b);
+
+profiling_counters
+operator-(profiling_counters const& a, profiling_counters const& b);
+
+// profiling_span records a timed span of a traversal.
+struct profiling_span
+{
+    // These must be string literals (or otherwise outlive the profiler).
+    char const* name;
+    char const* category;
+    // times (in nanoseconds) relative to the creation of the profiler -
+    // :duration is -1 while the span is still open.
+    std::int64_t start;
+    std::int64_t duration;
+    // the work done within the span - While the span is open, this holds the
+    // profiler's totals as of the start of the span.
+    profiling_counters counters;
+};
+
+struct traversal_profiler : noncopyable
+{
+    // the counters accumulated since the profiler was created (or reset)
+    profiling_counters totals;
+
+    // the counters for the last traversal that finished
+    profiling_counters last_traversal;
+
+    // the recorded spans, in the order that they started
+    std::vector<profiling_span> spans;
+
+    // Once this many spans have been recorded, recording stops (but the
+    // counters are still updated).
+    std::size_t max_spans = 1000000;
+
+    // If this is set, every data block that's activated is recorded as its
+    // own span. This shows exactly where time is going, but it adds a lot of
+    // overhead (and spans).
+    bool record_data_blocks = false;
+
+    // Begin a span and return its index (or no_span if it wasn't recorded).
+    std::size_t
+    begin_span(char const* name, char const* category);
+
+    // End the span with the given index (which may be no_span).
+    void
+    end_span(std::size_t index);
+
+    // Clear the counters and spans.
+    void
+    reset();
+
+    static std::size_t const no_span = ~std::size_t(0);
+
+ private:
+    std::int64_t
+    now() const;
+
+    std::chrono::steady_clock::time_point epoch_
+        = std::chrono::steady_clock::now();
+};
+
+// Write the spans recorded by :profiler to :out in the Chrome trace event
+// (JSON) format. Each span's counters are included as its arguments.
+void
+write_chrome_trace(std::ostream& out, traversal_profiler const& profiler);
+
+// scoped_profiling_span records its scope as a span (if the traversal is being
+// profiled). It's intended to mark out interesting parts of an application's
+// UI, so they show up in the trace with their own timings and counters.
+//
+// :name (and :category) must be string literals (or otherwise outlive the
+// profiler).
+struct scoped_profiling_span : noncopyable
+{
+    scoped_profiling_span()
+    {
+    }
+    template<class Context>
+    scoped_profiling_span(
+        Context ctx, char const* name, char const* category = "ui")
+    {
+        begin(ctx, name, category);
+    }
+    ~scoped_profiling_span()
+    {
+        end();
+    }
+    template<class Context>
+    void
+    begin(Context ctx, char const* name, char const* category = "ui")
+    {
+        begin(get_data_traversal(ctx).profiler, name, category);
+    }
+    void
+    begin(traversal_profiler* profiler, char const* name, char const* category)
+    {
+        profiler_ = profiler;
+        if (profiler)
+            span_ = profiler->begin_span(name, category);
+    }
+    void
+    end()
+    {
+        if (profiler_)
+        {
+            profiler_->end_span(span_);
+            profiler_ = nullptr;
+        }
+    }
+
+ private:
+    traversal_profiler* profiler_ = nullptr;
+    std::size_t span_;
+};
+
+} // namespace alia
+
+
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <new>
+#include <string>
+#include <vector>
+
+// This file defines the data retrieval library used for associating mutable
+// state and cached data with alia content graphs. It is designed so that each
+// node emitted by an application is associated with a unique instance of data,
+// even if there is no specific external identifier for that node.
+//
+// More generally, if you replace "node" with "subexpression evaluation" in the
+// previous sentence, it can be used to associate data with particular points in
+// the evaluation of any function. This can be useful in situations where you
+// need to evaluate a particular function many times with slightly different
+// inputs and you want to reuse the work that was done in earlier evaluations
+// without a lot of manual bookkeeping.
+//
+// To understand what's going on here, imagine the evaluation of a function on
+// a simple in-order, single-threaded processor. We can represent all possible
+// execution flows using a single DAG where each node represents the execution
+// of a particular instruction by the processor and edges represent the
+// transition to the next instruction. Nodes with multiple edges leaving them
 // represent the execution of branch instructions, while nodes with multiple
 // edges coming in are points where multiple branches merge back into a single
 // flow.
@@ -2273,6 +2905,146 @@ namespace alia {
 // data_node is a base class for all data nodes.
 // typed_data_node<T> represents data nodes that store values of type T.
 //
+
+// A data_pool is an optional, per-graph allocator for data nodes. It's a
+// size-class slab allocator: nodes are carved out of large chunks, and nodes
+// that are released go onto a free list for their size class, so building and
+// tearing down parts of the graph rarely touches the general-purpose heap, and
+// nodes that are created together tend to end up close together in memory.
+//
+// The chunks are only returned to the heap when the pool is destroyed (along
+// with its graph).
+//
+struct data_pool : noncopyable
+{
+    // Allocations are rounded up to a multiple of this, which also determines
+    // their alignment.
+    static constexpr std::size_t granularity = alignof(std::max_align_t);
+    static constexpr std::size_t size_class_count = 16;
+    static constexpr std::size_t max_size = granularity * size_class_count;
+    static constexpr std::size_t chunk_size = 16384;
+
+    ~data_pool();
+
+    // free lists for each size class
+    void* free_lists[size_class_count] = {};
+
+    // the list of chunks that have been allocated (linked through their first
+    // word) and the unused portion of the most recent one
+    void* chunks = nullptr;
+    char* chunk_cursor = nullptr;
+    char* chunk_end = nullptr;
+};
+
+// Can objects of the given type be allocated from a data_pool?
+template<class T>
+constexpr bool
+fits_in_data_pool()
+{
+    return sizeof(T) <= data_pool::max_size
+           && alignof(T) <= data_pool::granularity;
+}
+
+// Allocate/free storage within a pool. :size must be no more than
+// data_pool::max_size, and it must be the same for both calls.
+void*
+allocate_pooled_data(data_pool& pool, std::size_t size);
+void
+free_pooled_data(data_pool& pool, void* storage, std::size_t size);
+
+// Each data node records the type of data it stores. If
+// ALIA_CHECKED_DATA_ACCESS is defined, retrievals verify that they're asking
+// for the same type. (A mismatch means that the order of data requests within
+// a block changed without a corresponding control flow annotation.) This is
+// on by default in debug builds. In release builds, retrievals are unchecked.
+//
+// The type is recorded in all builds so that the layout of data nodes doesn't
+// depend on the build settings. (Translation units that are built with
+// different settings can share a data graph.)
+#if !defined(NDEBUG) && !defined(ALIA_CHECKED_DATA_ACCESS)
+#define ALIA_CHECKED_DATA_ACCESS
+#endif
+
+// data_type_tag<T>() gives a unique tag for the type T.
+template<class T>
+struct data_type_tag_storage
+{
+    static char const tag;
+};
+template<class T>
+char const data_type_tag_storage<T>::tag = 0;
+template<class T>
+void const*
+data_type_tag()
+{
+    return &data_type_tag_storage<T>::tag;
+}
+
+// data_memory_usage accumulates the memory that's held by (part of) a data
+// graph. (See get_memory_usage(), below.)
+struct data_memory_usage
+{
+    // the number of data nodes and the bytes that they hold - This includes
+    // any heap memory that their values report owning (via
+    // get_alia_heap_size()).
+    std::size_t node_count = 0;
+    std::size_t node_bytes = 0;
+
+    // the part of :node_bytes that belongs to cached data (i.e., data that
+    // clear_cached_data() would release and that can be regenerated)
+    std::size_t cached_bytes = 0;
+
+    // the number of data blocks (including named ones) and named blocks
+    std::size_t block_count = 0;
+    std::size_t named_block_count = 0;
+
+    // the number of naming maps
+    std::size_t naming_map_count = 0;
+
+    // the bytes used to organize the data, rather than to store it (e.g., the
+    // named block nodes, the references to them and the naming map tables)
+    std::size_t structure_bytes = 0;
+};
+
+data_memory_usage&
+operator+=(data_memory_usage& a, data_memory_usage const& b);
+
+inline std::size_t
+get_total_bytes(data_memory_usage const& usage)
+{
+    return usage.node_bytes + usage.structure_bytes;
+}
+
+// get_alia_heap_size(value) gives the number of bytes of heap memory that
+// :value owns (beyond its own size), so that memory accounting can include
+// it. Types that own significant amounts of memory can report it by
+// providing their own overload (which will be found via ADL).
+template<class T>
+std::size_t
+get_alia_heap_size(T const&)
+{
+    return 0;
+}
+inline std::size_t
+get_alia_heap_size(std::string const& value)
+{
+    // Short strings are stored within the string object itself.
+    char const* data = value.data();
+    char const* self = reinterpret_cast<char const*>(&value);
+    if (data >= self && data < self + sizeof(value))
+        return 0;
+    return value.capacity() + 1;
+}
+template<class T, class Allocator>
+std::size_t
+get_alia_heap_size(std::vector<T, Allocator> const& value)
+{
+    std::size_t size = value.capacity() * sizeof(T);
+    for (auto const& item : value)
+        size += get_alia_heap_size(item);
+    return size;
+}
+
 struct data_node : noncopyable
 {
     data_node() : next(0)
@@ -2281,14 +3053,100 @@ struct data_node : noncopyable
     virtual ~data_node()
     {
     }
+
+    // Clear any cached data stored in this node.
+    virtual void
+    clear_cache()
+    {
+    }
+
+    // Destroy this node. :pool is the pool that the node was created from (or
+    // null if it was created on the heap).
+    virtual void
+    release(data_pool* pool)
+        = 0;
+
+    // Add the memory that this node holds to :usage.
+    virtual void
+    add_memory_usage(data_memory_usage& usage) const
+        = 0;
+
     data_node* next;
+
+    // the tag of the type of data stored in this node
+    void const* type_tag = nullptr;
+};
+
+// data_node_traits<T> defines the type-specific behavior of nodes that store
+// values of type T. It's specialized below for the types that hold cached data.
+template<class T>
+struct data_node_traits
+{
+    static void
+    clear_cache(T&)
+    {
+    }
+
+    // Add whatever memory :value holds outside of its node to :usage.
+    static void
+    add_memory_usage(T const& value, data_memory_usage& usage)
+    {
+        usage.node_bytes += get_alia_heap_size(value);
+    }
 };
+
 template<class T>
 struct typed_data_node : data_node
 {
+    typed_data_node()
+    {
+        this->type_tag = data_type_tag<T>();
+    }
+
     T value;
+
+    void
+    clear_cache()
+    {
+        data_node_traits<T>::clear_cache(value);
+    }
+
+    void
+    add_memory_usage(data_memory_usage& usage) const
+    {
+        ++usage.node_count;
+        usage.node_bytes += sizeof(typed_data_node);
+        data_node_traits<T>::add_memory_usage(value, usage);
+    }
+
+    void
+    release(data_pool* pool)
+    {
+        if (pool && fits_in_data_pool<typed_data_node>())
+        {
+            this->~typed_data_node();
+            free_pooled_data(*pool, this, sizeof(typed_data_node));
+        }
+        else
+        {
+            delete this;
+        }
+    }
 };
 
+// Create a typed_data_node<T>, using :pool if possible.
+template<class T>
+typed_data_node<T>*
+create_data_node(data_pool* pool)
+{
+    if (pool && fits_in_data_pool<typed_data_node<T>>())
+    {
+        return new (allocate_pooled_data(*pool, sizeof(typed_data_node<T>)))
+            typed_data_node<T>;
+    }
+    return new typed_data_node<T>;
+}
+
 struct named_block_ref_node;
 
 // A data_block represents a block of execution. During a single evaluation,
@@ -2311,6 +3169,10 @@ struct data_block : noncopyable
     // constant, we can find the blocks with a very small, constant cost.
     named_block_ref_node* named_blocks = nullptr;
 
+    // the pool that the nodes in this block are allocated from (if any) -
+    // This is set whenever the block is activated.
+    data_pool* pool = nullptr;
+
     ~data_block();
 };
 
@@ -2319,11 +3181,45 @@ struct data_block : noncopyable
 void
 clear_data_block(data_block& block);
 
+// Clear all cached data stored within a data block.
+// Note that this recursively processes child blocks.
+void
+clear_cached_data(data_block& block);
+
+// Add the memory held by :block (including its child blocks and the named
+// blocks that it references) to :usage.
+void
+add_memory_usage(data_block const& block, data_memory_usage& usage);
+
+template<>
+struct data_node_traits<data_block>
+{
+    static void
+    clear_cache(data_block& block)
+    {
+        clear_cached_data(block);
+    }
+
+    static void
+    add_memory_usage(data_block const& block, data_memory_usage& usage)
+    {
+        alia::add_memory_usage(block, usage);
+    }
+};
+
 struct naming_map_node;
+struct named_block_node;
 
 // data_graph stores the data graph associated with a function.
 struct data_graph : noncopyable
 {
+    ~data_graph();
+
+    // the pool that the graph's nodes are allocated from - If this is null
+    // (the default), nodes are allocated directly on the heap.
+    // Note that this is declared first so that it outlives all the nodes.
+    std::unique_ptr<data_pool> pool;
+
     data_block root_block;
 
     naming_map_node* map_list = nullptr;
@@ -2336,8 +3232,22 @@ struct data_graph : noncopyable
     // blocks. They're cleaned up when someone calls gc_named_data(graph)
     // following a complete traversal.
     named_block_ref_node* unused_named_block_refs = nullptr;
+
+    // If this is set, named blocks that disappear from the graph aren't
+    // destroyed on the spot. Instead, they're taken out of their naming maps
+    // and queued in :dead_named_blocks, along with all their data, until
+    // someone calls collect_dead_named_blocks(graph, budget). This spreads the
+    // cost of destroying large numbers of blocks (e.g., when a long list is
+    // cleared) over several frames.
+    bool incremental_gc = false;
+    std::vector<named_block_node*> dead_named_blocks;
 };
 
+// Enable pooled allocation of the nodes in :graph. This must be called before
+// the graph is first traversed.
+void
+enable_data_pool(data_graph& graph);
+
 struct naming_map;
 
 // data_traversal stores the state associated with a single traversal of a
@@ -2353,6 +3263,8 @@ struct data_traversal
     data_node** next_data_ptr;
     bool gc_enabled;
     bool cache_clearing_enabled;
+    // the profiler that's recording this traversal (if any)
+    traversal_profiler* profiler = nullptr;
 };
 
 // The utilities here operate on data_traversals. However, the data_graph
@@ -2409,6 +3321,8 @@ struct scoped_data_block : noncopyable
 
  private:
     data_traversal* traversal_;
+    // the span recording this block (if the profiler is recording blocks)
+    std::size_t profiling_span_;
     // old state
     data_block* old_active_block_;
     named_block_ref_node* old_predicted_named_block_;
@@ -2595,6 +3509,49 @@ struct named_block_out_of_order : exception
 void
 disable_gc(data_traversal& traversal);
 
+// Destroy named blocks that are queued for destruction in :graph (see
+// data_graph::incremental_gc) until :budget has been used up. At least one
+// block is destroyed per call (if any are queued), so this always makes
+// progress. Note that destroying a block can queue the named blocks inside it.
+// The return value is the number of blocks left in the queue.
+std::size_t
+collect_dead_named_blocks(
+    data_graph& graph, std::chrono::steady_clock::duration budget);
+
+// MEMORY ACCOUNTING - These functions walk (part of) a data graph and report
+// the memory that it holds. Since they visit every node, they're intended for
+// monitoring and diagnostics rather than for use on every frame.
+
+// Get the memory held by :graph as a whole.
+data_memory_usage
+get_memory_usage(data_graph const& graph);
+
+// Get the memory held by the named block with the given ID (in any of
+// :graph's naming maps).
+data_memory_usage
+get_named_block_memory_usage(data_graph const& graph, id_interface const& id);
+
+// naming_map_memory_usage is the memory held by a single naming map, which
+// includes all the named blocks in it. Note that the usage of a naming map
+// includes any naming maps nested within its blocks.
+struct naming_map_memory_usage
+{
+    naming_map const* map;
+    data_memory_usage usage;
+};
+
+// Get the memory held by each of :graph's naming maps.
+std::vector<naming_map_memory_usage>
+get_naming_map_memory_usage(data_graph const& graph);
+
+// If the memory held by :graph exceeds :budget (in bytes), release what can be
+// released. Named blocks that are queued for destruction go first. If that
+// isn't enough, all cached data in the graph is cleared, and it's up to the
+// next refresh to regenerate whatever is actually still in use.
+// The return value is true iff the cached data was cleared.
+bool
+reduce_memory_usage(data_graph& graph, std::size_t budget);
+
 // scoped_cache_clearing_disabler will prevent the library from clearing the
 // cache of inactive blocks within its scope.
 struct scoped_cache_clearing_disabler
@@ -2644,16 +3601,25 @@ get_data(Context& ctx, T** ptr)
     data_node* node = *traversal.next_data_ptr;
     if (node)
     {
-        if (!dynamic_cast<typed_data_node<T>*>(node))
-            assert(dynamic_cast<typed_data_node<T>*>(node));
+#ifdef ALIA_CHECKED_DATA_ACCESS
+        assert(node->type_tag == data_type_tag<T>());
+#endif
         typed_data_node<T>* typed_node = static_cast<typed_data_node<T>*>(node);
         traversal.next_data_ptr = &node->next;
         *ptr = &typed_node->value;
+        if (traversal.profiler)
+            ++traversal.profiler->totals.data_nodes;
         return false;
     }
     else
     {
-        typed_data_node<T>* new_node = new typed_data_node<T>;
+        if (traversal.profiler)
+        {
+            ++traversal.profiler->totals.data_nodes;
+            ++traversal.profiler->totals.new_data_nodes;
+        }
+        typed_data_node<T>* new_node
+            = create_data_node<T>(traversal.active_block->pool);
         *traversal.next_data_ptr = new_node;
         traversal.next_data_ptr = &new_node->next;
         *ptr = &new_node->value;
@@ -2676,49 +3642,92 @@ get_data(Context& ctx)
 // data stored in the node is understood to be a cached value of data that's
 // generated by the application. The system assumes that the data can be
 // regenerated if it's lost.
+//
+// The cached value is stored directly within its data node (so it doesn't
+// require an allocation of its own), but it's only constructed while it's
+// actually cached.
 
-struct cached_data
+template<class T>
+struct cached_data_holder
 {
-    virtual ~cached_data()
+    cached_data_holder()
     {
     }
-};
+    ~cached_data_holder()
+    {
+        clear();
+    }
+    bool
+    is_constructed() const
+    {
+        return constructed_;
+    }
+    T&
+    construct()
+    {
+        new (&storage_) T();
+        constructed_ = true;
+        return get();
+    }
+    T&
+    get()
+    {
+        return *reinterpret_cast<T*>(&storage_);
+    }
+    T const&
+    get() const
+    {
+        return *reinterpret_cast<T const*>(&storage_);
+    }
+    void
+    clear()
+    {
+        if (constructed_)
+        {
+            get().~T();
+            constructed_ = false;
+        }
+    }
 
-template<class T>
-struct typed_cached_data : cached_data
-{
-    T value;
+ private:
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage_;
+    bool constructed_ = false;
 };
 
-struct cached_data_holder
+template<class T>
+struct data_node_traits<cached_data_holder<T>>
 {
-    cached_data_holder() : data(0)
+    static void
+    clear_cache(cached_data_holder<T>& holder)
     {
+        holder.clear();
     }
-    ~cached_data_holder()
+
+    static void
+    add_memory_usage(
+        cached_data_holder<T> const& holder, data_memory_usage& usage)
     {
-        delete data;
+        if (holder.is_constructed())
+        {
+            std::size_t heap_size = get_alia_heap_size(holder.get());
+            usage.node_bytes += heap_size;
+            usage.cached_bytes += sizeof(T) + heap_size;
+        }
     }
-    cached_data* data;
 };
 
 template<class Context, class T>
 bool
 get_cached_data(Context& ctx, T** ptr)
 {
-    cached_data_holder* holder;
+    cached_data_holder<T>* holder;
     get_data(ctx, &holder);
-    if (holder->data)
+    if (holder->is_constructed())
     {
-        assert(dynamic_cast<typed_cached_data<T>*>(holder->data));
-        typed_cached_data<T>* data
-            = static_cast<typed_cached_data<T>*>(holder->data);
-        *ptr = &data->value;
+        *ptr = &holder->get();
         return false;
     }
-    typed_cached_data<T>* data = new typed_cached_data<T>;
-    holder->data = data;
-    *ptr = &data->value;
+    *ptr = &holder->construct();
     return true;
 }
 
@@ -2733,11 +3742,6 @@ get_cached_data(Context& ctx)
     return *data;
 }
 
-// Clear all cached data stored within a data block.
-// Note that this recursively processes child blocks.
-void
-clear_cached_data(data_block& block);
-
 // get_keyed_data(ctx, key, &signal) is a utility for retrieving cached data
 // from a data graph.
 // It stores not only the data but also a key that identifies the data.
@@ -2932,6 +3936,10 @@ struct scoped_data_traversal
 } // namespace alia
 
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+
 namespace alia {
 
 millisecond_count
@@ -2945,6 +3953,26 @@ struct external_interface
     {
     }
 
+    // alia calls this when something has happened that requires a refresh
+    // (e.g., an event was just processed). If the external system can defer
+    // the refresh (ideally coalescing multiple requests into a single
+    // refresh), it should arrange for that and return true. If this returns
+    // false, alia refreshes the system immediately.
+    virtual bool
+    schedule_refresh()
+    {
+        return false;
+    }
+
+    // alia calls this when work has been posted to the system's completion
+    // queue. Unlike the other methods, this may be called from ANY thread. It
+    // should arrange for the system to be refreshed on its own thread. (If
+    // this does nothing, the completions are processed on the next refresh.)
+    virtual void
+    schedule_refresh_from_any_thread()
+    {
+    }
+
     // Get the current value of the system's millisecond tick counter.
     // The default implementation of this uses std::chrono::steady_clock.
     virtual millisecond_count
@@ -2954,16 +3982,102 @@ struct external_interface
     }
 };
 
-struct system
+struct thread_pool;
+
+// An async_completion is a piece of work that's been posted to a system from
+// another thread. It's run on the system's own thread, where it's safe to
+// touch the system's data graph.
+struct async_completion
 {
-    data_graph data;
-    std::function<void(context)> controller;
-    bool refresh_needed = false;
-    external_interface* external = nullptr;
+    virtual ~async_completion()
+    {
+    }
+
+    virtual void
+    complete()
+        = 0;
+
+    async_completion* next = nullptr;
 };
 
-inline bool
-system_needs_refresh(system const& sys)
+// async_completion_queue is a lock-free, multiple-producer, single-consumer
+// queue of completions. Producers push onto an intrusive stack, and the
+// consumer takes the whole stack at once (reversing it to restore the order in
+// which the completions were posted).
+struct async_completion_queue : noncopyable
+{
+    std::atomic<async_completion*> head{nullptr};
+
+    ~async_completion_queue();
+};
+
+// Push :completion onto :queue. (The queue takes ownership of it.)
+// This is safe to call from any thread.
+// The return value is true iff the queue was empty.
+bool
+push_completion(async_completion_queue& queue, async_completion* completion);
+
+// Run (and delete) all completions in :queue, in the order they were pushed.
+// This must only be called from the thread that owns the queue.
+// The return value is true iff any completions were run.
+bool
+run_completions(async_completion_queue& queue);
+
+struct state_snapshot;
+
+struct system;
+
+// system_completion_target is what work on other threads posts its results
+// through. It's shared with that work, so it outlives the system, and it
+// refers back to the system only as long as the system exists. (The system
+// clears :sys, under :mutex, when it's destroyed.)
+struct system_completion_target : noncopyable
+{
+    std::mutex mutex;
+    system* sys = nullptr;
+};
+
+struct system : noncopyable
+{
+    system();
+    ~system();
+
+    data_graph data;
+    std::function<void(context)> controller;
+    bool refresh_needed = false;
+    external_interface* external = nullptr;
+
+    // Has anything other than animation called for a refresh since the last
+    // one? If not, the next refresh can be done with refresh_animation_frame().
+    bool full_refresh_needed = true;
+
+    // If this is set, async() results are delivered through :completions,
+    // which makes it safe for async launchers to report results from other
+    // threads. The results are only applied to the data graph on the system's
+    // own thread, at the start of the next refresh.
+    bool thread_safe_async = false;
+    async_completion_queue completions;
+
+    // the target for work that posts back to this system from other threads
+    // (e.g., async_in_pool() jobs) - Such work should hold onto this rather
+    // than the system itself, since the system may be destroyed first.
+    std::shared_ptr<system_completion_target> completion_target;
+
+    // the thread pool used by async_in_pool() - If this is null, the default
+    // pool is used.
+    thread_pool* pool = nullptr;
+
+    // the profiler that records this system's traversals (if any) - See
+    // traversal_profiler.
+    traversal_profiler* profiler = nullptr;
+
+    // the snapshot that persistent state is seeded from and recorded in (if
+    // any) - See state_snapshot.
+    state_snapshot* snapshot = nullptr;
+};
+
+inline bool
+system_needs_refresh(system const& sys)
 {
     return sys.refresh_needed;
 }
@@ -2971,6 +4085,68 @@ system_needs_refresh(system const& sys)
 void
 refresh_system(system& sys);
 
+// Refresh the system for an animation frame. If the only things that have
+// called for a refresh since the last one are requests for animation, this
+// only traverses the frame regions that made those requests (see
+// invoke_frame_region). Otherwise, it's equivalent to refresh_system().
+void
+refresh_animation_frame(system& sys);
+
+// Post :completion to the system's completion queue and make sure that the
+// system gets refreshed (on its own thread) to process it.
+// This is safe to call from any thread.
+void
+post_completion(system& sys, async_completion* completion);
+
+template<class Function>
+struct typed_async_completion : async_completion
+{
+    typed_async_completion(Function function) : function(std::move(function))
+    {
+    }
+
+    void
+    complete()
+    {
+        function();
+    }
+
+    Function function;
+};
+
+// Post a function object to run on the system's own thread.
+template<class Function>
+void
+post_to_system_thread(system& sys, Function function)
+{
+    post_completion(
+        sys, new typed_async_completion<Function>(std::move(function)));
+}
+
+// Post a function object to run on the thread of the system behind :target.
+// If that system has already been destroyed, the function is discarded.
+// This is safe to call from any thread.
+template<class Function>
+void
+post_to_system_thread(system_completion_target& target, Function function)
+{
+    std::lock_guard<std::mutex> lock(target.mutex);
+    if (target.sys)
+        post_to_system_thread(*target.sys, std::move(function));
+}
+
+// Request a refresh of the system. This marks the system as needing a refresh
+// and gives the external interface a chance to schedule it for later. If it
+// doesn't, the system is refreshed immediately.
+void
+schedule_refresh(system& sys);
+
+// Do reduce_memory_usage() on the system's data graph. If that clears cached
+// data, the system is refreshed immediately so that the data (and whatever
+// the application builds from it) is regenerated.
+void
+reduce_memory_usage(system& sys, std::size_t budget);
+
 } // namespace alia
 
 
@@ -3331,6 +4507,120 @@ simplify_id(Wrapped wrapped)
     return simplified_id_wrapper<Wrapped>(wrapped);
 }
 
+// identify_by_hash(ctx, s), where :s is a signal, yields a wrapper for :s with
+// the exact same read/write behavior but whose value ID is a hashed_id of its
+// value. Capturing and testing the ID are then O(1). The hash is cached (in
+// the data graph) along with the value ID of :s, so the value is only rehashed
+// when that changes. This pays off when :s itself is identified cheaply (e.g.,
+// state, which is identified by a version number) but its value still needs a
+// content-based identity (e.g., to be matched up across runs).
+//
+// identify_by_version(s, version) is similar, but the value ID is given by
+// :version (a signal carrying a counter_type), which whoever owns the value
+// must change whenever the value changes. (0 isn't a valid version. If
+// :version is 0, the value is hashed each time.) This makes value_id() O(1)
+// without any caching.
+//
+// Both of these are meant for signals carrying large values (long strings,
+// big containers, etc.), which would otherwise be identified by the values
+// themselves (and thus copied and deep-compared).
+//
+
+// the cached hash of a signal's value, as kept by identify_by_hash()
+struct id_content_hash_cache
+{
+    // the value ID of the signal when the hash was computed
+    captured_id value_id;
+    std::size_t hash = 0;
+};
+
+template<class Wrapped, class Version>
+struct hashed_id_wrapper : signal<
+                               hashed_id_wrapper<Wrapped, Version>,
+                               typename Wrapped::value_type,
+                               typename Wrapped::direction_tag>
+{
+    hashed_id_wrapper(
+        Wrapped wrapped,
+        Version version,
+        id_content_hash_cache* cache = nullptr)
+        : wrapped_(wrapped), version_(version), cache_(cache)
+    {
+    }
+    bool
+    has_value() const
+    {
+        return wrapped_.has_value();
+    }
+    typename Wrapped::value_type const&
+    read() const
+    {
+        return wrapped_.read();
+    }
+    id_interface const&
+    value_id() const
+    {
+        if (!this->has_value())
+            return null_id;
+        auto const& value = wrapped_.read();
+        counter_type version = version_.has_value() ? version_.read() : 0;
+        if (version == 0 && cache_)
+        {
+            id_interface const& wrapped_id = wrapped_.value_id();
+            if (!cache_->value_id.matches(wrapped_id))
+            {
+                cache_->hash = get_id_content_hash(value);
+                cache_->value_id.capture(wrapped_id);
+            }
+            id_ = hashed_id<typename Wrapped::value_type>(
+                cache_->hash, get_id_content_size(value), 0);
+        }
+        else
+        {
+            id_ = make_hashed_id(value, version);
+        }
+        return id_;
+    }
+    bool
+    ready_to_write() const
+    {
+        return wrapped_.ready_to_write();
+    }
+    void
+    write(typename Wrapped::value_type const& value) const
+    {
+        return wrapped_.write(value);
+    }
+
+ private:
+    Wrapped wrapped_;
+    Version version_;
+    id_content_hash_cache* cache_;
+    mutable hashed_id<typename Wrapped::value_type> id_;
+};
+template<class Wrapped>
+auto
+identify_by_hash(context ctx, Wrapped wrapped)
+{
+    static_assert(
+        is_id_content_hashable<typename Wrapped::value_type>::value,
+        "identify_by_hash() requires a value type that can be hashed "
+        "(via std::hash, or a std::vector of such types).");
+    id_content_hash_cache* cache;
+    get_cached_data(ctx, &cache);
+    auto no_version = value(counter_type(0));
+    return hashed_id_wrapper<Wrapped, decltype(no_version)>(
+        wrapped, no_version, cache);
+}
+template<class Wrapped, class Version>
+auto
+identify_by_version(Wrapped wrapped, Version version)
+{
+    auto version_signal = signalize(version);
+    return hashed_id_wrapper<Wrapped, decltype(version_signal)>(
+        wrapped, version_signal);
+}
+
 // mask(signal, condition) does the equivalent of bit masking on individual
 // signals. If :condition evaluates to true, the mask evaluates to :signal.
 // Otherwise, it evaluates to an empty signal of the same type.
@@ -3784,6 +5074,10 @@ read_condition(T const& x)
 } // namespace alia
 
 
+#include <memory>
+#include <typeinfo>
+#include <vector>
+
 // This file implements utilities for routing events through an alia content
 // traversal function.
 //
@@ -3807,13 +5101,129 @@ namespace alia {
 struct system;
 struct routing_region;
 
-typedef std::shared_ptr<routing_region> routing_region_ptr;
+// routing_region_ptr is an intrusive, reference-counted pointer to a
+// routing_region. Since routing regions are only ever referenced from the
+// system's own thread, the reference counting isn't atomic.
+struct routing_region_ptr
+{
+    routing_region_ptr() : region_(nullptr)
+    {
+    }
+    // Take (shared) ownership of :region.
+    explicit routing_region_ptr(routing_region* region);
+    routing_region_ptr(routing_region_ptr const& other);
+    routing_region_ptr(routing_region_ptr&& other) : region_(other.region_)
+    {
+        other.region_ = nullptr;
+    }
+    ~routing_region_ptr()
+    {
+        reset();
+    }
+
+    routing_region_ptr&
+    operator=(routing_region_ptr const& other);
+    routing_region_ptr&
+    operator=(routing_region_ptr&& other);
+
+    void
+    reset(routing_region* region = nullptr);
+
+    routing_region*
+    get() const
+    {
+        return region_;
+    }
+    routing_region&
+    operator*() const
+    {
+        return *region_;
+    }
+    routing_region*
+    operator->() const
+    {
+        return region_;
+    }
+    explicit operator bool() const
+    {
+        return region_ != nullptr;
+    }
+
+ private:
+    routing_region* region_;
+};
+
+inline bool
+operator==(routing_region_ptr const& a, routing_region_ptr const& b)
+{
+    return a.get() == b.get();
+}
+inline bool
+operator!=(routing_region_ptr const& a, routing_region_ptr const& b)
+{
+    return a.get() != b.get();
+}
 
 struct routing_region
 {
     routing_region_ptr parent;
+
+    // Is the content of this region possibly out-of-date? This is set when
+    // something within the region (or one of its subregions) changes, and it's
+    // cleared when the region is refreshed. (See invoke_pure_component.)
+    bool dirty = true;
+
+    // the number of routing_region_ptrs that reference this region
+    int reference_count = 0;
 };
 
+inline routing_region_ptr::routing_region_ptr(routing_region* region)
+    : region_(region)
+{
+    if (region_)
+        ++region_->reference_count;
+}
+inline routing_region_ptr::routing_region_ptr(routing_region_ptr const& other)
+    : region_(other.region_)
+{
+    if (region_)
+        ++region_->reference_count;
+}
+inline routing_region_ptr&
+routing_region_ptr::operator=(routing_region_ptr const& other)
+{
+    // Assigning a region to itself is very common (since widgets record their
+    // regions on every refresh), so this is checked first.
+    if (region_ != other.region_)
+        this->reset(other.region_);
+    return *this;
+}
+inline routing_region_ptr&
+routing_region_ptr::operator=(routing_region_ptr&& other)
+{
+    if (this != &other)
+    {
+        this->reset();
+        region_ = other.region_;
+        other.region_ = nullptr;
+    }
+    return *this;
+}
+inline void
+routing_region_ptr::reset(routing_region* region)
+{
+    if (region)
+        ++region->reference_count;
+    routing_region* old = region_;
+    region_ = region;
+    if (old && --old->reference_count == 0)
+        delete old;
+}
+
+// Mark :region (and all its ancestors) as dirty.
+void
+mark_dirty(routing_region* region);
+
 struct event_routing_path
 {
     routing_region* node;
@@ -3838,6 +5248,16 @@ get_active_routing_region(Context ctx)
                                    : routing_region_ptr();
 }
 
+// Same, but this returns a raw pointer (which is only valid as long as the
+// region's data is).
+template<class Context>
+routing_region*
+get_active_routing_region_pointer(Context ctx)
+{
+    event_traversal& traversal = get_event_traversal(ctx);
+    return traversal.active_region ? traversal.active_region->get() : nullptr;
+}
+
 namespace impl {
 
 // Set up the event traversal so that it will route the control flow to the
@@ -3876,7 +5296,7 @@ void
 dispatch_event(system& sys, Event& event)
 {
     impl::dispatch_event(sys, event);
-    refresh_system(sys);
+    schedule_refresh(sys);
 }
 
 struct traversal_aborted
@@ -3912,9 +5332,16 @@ struct scoped_routing_region
         return is_relevant_;
     }
 
+    routing_region*
+    region() const
+    {
+        return region_;
+    }
+
  private:
     event_traversal* traversal_;
     routing_region_ptr* parent_;
+    routing_region* region_;
     bool is_relevant_;
 };
 
@@ -3992,7 +5419,7 @@ dispatch_targeted_event(system& sys, Event& event, routable_node_id const& id)
 {
     event.target_id = id.id;
     impl::dispatch_targeted_event(sys, event, id.region);
-    refresh_system(sys);
+    schedule_refresh(sys);
 }
 
 template<class Event>
@@ -4015,10 +5442,121 @@ on_targeted_event(Context ctx, node_id id, Handler&& handler)
     ALIA_END
 }
 
+// event_batch collects a sequence of events so that they can be delivered in
+// one go by dispatch_batch.
+struct event_batch : noncopyable
+{
+    // Add a targeted event.
+    template<class Event>
+    void
+    add(Event event, routable_node_id const& target)
+    {
+        event.target_id = target.id;
+        add_event(new typed_batched_event<Event>(std::move(event))).region
+            = target.region;
+    }
+
+    // Add an untargeted event (one that's delivered to the whole content
+    // graph).
+    template<class Event>
+    void
+    add(Event event)
+    {
+        add_event(new typed_batched_event<Event>(std::move(event))).targeted
+            = false;
+    }
+
+    size_t
+    size() const
+    {
+        return events_.size();
+    }
+
+    void
+    clear()
+    {
+        events_.clear();
+    }
+
+    struct batched_event
+    {
+        virtual ~batched_event()
+        {
+        }
+
+        virtual void*
+        event()
+            = 0;
+
+        virtual std::type_info const&
+        type() const = 0;
+
+        bool targeted = true;
+
+        // the routing region of the targeted node
+        routing_region_ptr region;
+    };
+
+    std::vector<std::unique_ptr<batched_event>> const&
+    events() const
+    {
+        return events_;
+    }
+
+ private:
+    template<class Event>
+    struct typed_batched_event : batched_event
+    {
+        typed_batched_event(Event event) : value(std::move(event))
+        {
+        }
+
+        void*
+        event()
+        {
+            return &value;
+        }
+
+        std::type_info const&
+        type() const
+        {
+            return typeid(Event);
+        }
+
+        Event value;
+    };
+
+    template<class Event>
+    batched_event&
+    add_event(typed_batched_event<Event>* event)
+    {
+        events_.emplace_back(event);
+        return *event;
+    }
+
+    std::vector<std::unique_ptr<batched_event>> events_;
+};
+
+// Deliver all the events in :batch (in order) and then do a single refresh.
+//
+// Each event is delivered in its own traversal, routed just as it would be by
+// dispatch_event or dispatch_targeted_event (so with pure components, a
+// targeted event only visits the path to its target). Events are never
+// delivered together, since an event handler's writes only propagate to the
+// values that later handlers see (apply results, etc.) once the traversal
+// that derives them runs again. What the batch saves is the refresh (and the
+// refresh scheduling) that would otherwise follow each event.
+void
+dispatch_batch(system& sys, event_batch const& batch);
+
 // the refresh event...
 
 struct refresh_event
 {
+    // Is this an animation frame refresh? (See refresh_animation_frame().)
+    // Within a frame region that has to be traversed, this is cleared, so
+    // everything inside that region is refreshed normally.
+    bool animation_frame = false;
 };
 
 inline bool
@@ -4028,6 +5566,13 @@ is_refresh_event(dataless_context ctx)
     return detect_event(ctx, &e);
 }
 
+inline bool
+is_animation_frame_refresh(dataless_context ctx)
+{
+    refresh_event* e;
+    return detect_event(ctx, &e) && e->animation_frame;
+}
+
 template<class Context, class Handler>
 void
 on_refresh(Context ctx, Handler handler)
@@ -4039,22 +5584,120 @@ on_refresh(Context ctx, Handler handler)
     ALIA_END
 }
 
-} // namespace alia
+// pure_component_block is the mechanism behind invoke_pure_component. It
+// places the content of a component within its own routing region and data
+// block and decides whether or not that content needs to be traversed.
+struct pure_component_block : noncopyable
+{
+    ~pure_component_block()
+    {
+        end();
+    }
 
+    // Begin the block. :args_id identifies the component's inputs.
+    // The return value indicates whether or not the component's content should
+    // be traversed. (If it's false, the content is skipped entirely and left
+    // exactly as it was.)
+    bool
+    begin(context ctx, id_interface const& args_id);
 
-namespace alia {
+    void
+    end();
 
-// lazy_apply(f, args...), where :args are all signals, yields a signal
-// to the result of lazily applying the function :f to the values of :args.
+ private:
+    scoped_routing_region region_;
+    scoped_data_block block_;
+};
 
-// Note that doing this in true variadic fashion is a little insane, so I'm
-// just doing the two overloads I need for now...
+// invoke_pure_component(ctx, component, args...) invokes
+// component(ctx, args...), where :args are all signals.
+//
+// The component is treated as a pure function of its arguments and whatever
+// state it holds internally. On refresh passes, if none of the arguments'
+// value IDs has changed and nothing within the component has been marked
+// dirty (e.g., by writing to state that was retrieved within it), the
+// component isn't invoked at all. On targeted events, the component is only
+// invoked if the event is targeted at something inside it.
+//
+// Note that this means that the component must get all of its external inputs
+// from :args.
+template<class Context, class Component, class... Args>
+void
+invoke_pure_component(Context ctx, Component&& component, Args const&... args)
+{
+    pure_component_block block;
+    if (block.begin(ctx, combine_ids(unit_id, ref(args.value_id())...)))
+        component(ctx, args...);
+}
 
-template<class Result, class Function, class Arg>
-struct lazy_apply1_signal : signal<
-                                lazy_apply1_signal<Result, Function, Arg>,
-                                Result,
-                                read_only_signal>
+// frame_region_block is the mechanism behind invoke_frame_region. It places
+// its content within its own routing region and data block and decides
+// whether or not that content needs to be traversed.
+struct frame_region_block : noncopyable
+{
+    ~frame_region_block()
+    {
+        end();
+    }
+
+    // Begin the block.
+    // The return value indicates whether or not the content should be
+    // traversed. (If it's false, the content is skipped entirely and left
+    // exactly as it was.)
+    bool
+    begin(context ctx);
+
+    void
+    end();
+
+ private:
+    scoped_routing_region region_;
+    scoped_data_block block_;
+    refresh_event* frame_refresh_ = nullptr;
+};
+
+// invoke_frame_region(ctx, content) invokes content(ctx) within a region that
+// animation frames can skip.
+//
+// Unlike a pure component, the content is traversed on every ordinary pass,
+// so it's free to get its inputs from anywhere. However, on animation frame
+// refreshes (see refresh_animation_frame()), it's only traversed if something
+// within it has been marked dirty since it was last traversed (as anything
+// that requests an animation refresh is). When it is traversed, all of it is
+// refreshed normally.
+//
+// Note that this means that, during animation, the content mustn't depend on
+// animated values that are computed outside of it.
+template<class Context, class Content>
+void
+invoke_frame_region(Context ctx, Content&& content)
+{
+    frame_region_block block;
+    if (block.begin(ctx))
+        content(ctx);
+}
+
+} // namespace alia
+
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace alia {
+
+// lazy_apply(f, args...), where :args are all signals, yields a signal
+// to the result of lazily applying the function :f to the values of :args.
+
+// Note that doing this in true variadic fashion is a little insane, so I'm
+// just doing the two overloads I need for now...
+
+template<class Result, class Function, class Arg>
+struct lazy_apply1_signal : signal<
+                                lazy_apply1_signal<Result, Function, Arg>,
+                                Result,
+                                read_only_signal>
 {
     lazy_apply1_signal(Function f, Arg arg) : f_(f), arg_(arg)
     {
@@ -4273,6 +5916,237 @@ lift(Function f)
     return [=](context ctx, auto&&... args) { return apply(ctx, f, args...); };
 }
 
+// memoization_limits specifies how many results apply_memoized is allowed to
+// keep around.
+struct memoization_limits
+{
+    memoization_limits(size_t max_entries, size_t max_bytes = 0)
+        : max_entries(max_entries), max_bytes(max_bytes)
+    {
+    }
+
+    // the maximum number of results to keep (including the current one)
+    size_t max_entries;
+
+    // the maximum (estimated) total size of the results, in bytes - If this is
+    // 0, there's no limit. (The current result is always kept.)
+    size_t max_bytes;
+};
+
+// estimate_memoized_size(value) estimates the memory used by :value when it's
+// held by apply_memoized. Overloads can be provided (via ADL) for other types
+// that own significant amounts of memory.
+template<class Value>
+size_t
+estimate_memoized_size(Value const&)
+{
+    return sizeof(Value);
+}
+template<class Char, class Traits, class Allocator>
+size_t
+estimate_memoized_size(std::basic_string<Char, Traits, Allocator> const& value)
+{
+    return sizeof(value) + value.capacity() * sizeof(Char);
+}
+template<class Item, class Allocator>
+size_t
+estimate_memoized_size(std::vector<Item, Allocator> const& value)
+{
+    return sizeof(value) + value.capacity() * sizeof(Item);
+}
+
+struct memoization_stats
+{
+    // the number of times the arguments changed to ones with a cached result
+    size_t hits = 0;
+    // the number of times the function actually had to be called
+    size_t misses = 0;
+    // the number of results that were discarded to stay within the limits
+    size_t evictions = 0;
+    // the current number of results and their estimated total size
+    size_t entry_count = 0;
+    size_t total_bytes = 0;
+};
+
+template<class Value>
+struct memoized_apply_data
+{
+    struct entry
+    {
+        captured_id args_id;
+        Value result;
+        size_t size;
+        // This uniquely identifies the result (within this data).
+        counter_type version;
+    };
+
+    // the cached results, most recently used first
+    std::list<entry> entries;
+
+    // the entries, indexed by their argument IDs
+    std::map<
+        id_interface const*,
+        typename std::list<entry>::iterator,
+        id_interface_pointer_less_than_test>
+        index;
+
+    // the entry for the current arguments - If the current arguments aren't
+    // ready (or the function failed on them), this is entries.end().
+    typename std::list<entry>::iterator current = entries.end();
+
+    apply_status status = apply_status::UNCOMPUTED;
+
+    // If the function failed on the current arguments, this identifies them,
+    // so that (as with apply) it's only called again once they change.
+    captured_id failed_args_id;
+
+    counter_type next_version = 1;
+
+    memoization_stats stats;
+};
+
+template<class Value>
+struct memoized_apply_signal
+    : signal<memoized_apply_signal<Value>, Value, read_only_signal>
+{
+    memoized_apply_signal(memoized_apply_data<Value>& data) : data_(&data)
+    {
+    }
+    id_interface const&
+    value_id() const
+    {
+        id_ = make_id(has_value() ? data_->current->version : counter_type(0));
+        return id_;
+    }
+    bool
+    has_value() const
+    {
+        return data_->status == apply_status::READY;
+    }
+    Value const&
+    read() const
+    {
+        return data_->current->result;
+    }
+
+    // Get the statistics for the underlying cache.
+    memoization_stats const&
+    stats() const
+    {
+        return data_->stats;
+    }
+
+ private:
+    memoized_apply_data<Value>* data_;
+    mutable simple_id<counter_type> id_;
+};
+
+// Evict the least recently used results in :data until it's within :limits.
+template<class Value>
+void
+enforce_memoization_limits(
+    memoized_apply_data<Value>& data, memoization_limits const& limits)
+{
+    auto& stats = data.stats;
+    while (stats.entry_count > 1
+           && (stats.entry_count > limits.max_entries
+               || (limits.max_bytes != 0
+                   && stats.total_bytes > limits.max_bytes)))
+    {
+        auto last = std::prev(data.entries.end());
+        // The current entry is always at the front, so it's never evicted.
+        data.index.erase(&last->args_id.get());
+        stats.total_bytes -= last->size;
+        --stats.entry_count;
+        ++stats.evictions;
+        data.entries.erase(last);
+    }
+}
+
+// apply_memoized(ctx, f, limits, args...) is like apply(ctx, f, args...), but
+// rather than keeping only the result for the current arguments, it keeps a
+// cache of recent results (up to :limits, evicting the least recently used
+// ones first). If the arguments change back to ones that are still in the
+// cache, the cached result is used without calling :f.
+//
+// :limits can simply be the maximum number of results to keep.
+//
+// The arguments are checked on every pass (not just refreshes), so once an
+// event handler writes to one of them, later handlers in the same pass see
+// the result for the new arguments.
+template<class Function, class... Args>
+auto
+apply_memoized(
+    context ctx,
+    Function f,
+    memoization_limits const& limits,
+    Args const&... args)
+{
+    typedef decltype(f(read_signal(args)...)) result_type;
+    typedef memoized_apply_data<result_type> data_type;
+    data_type* data_ptr;
+    get_cached_data(ctx, &data_ptr);
+    auto& data = *data_ptr;
+
+    auto args_id = combine_ids(unit_id, ref(args.value_id())...);
+    if (!signals_all_have_values(args...))
+    {
+        data.status = apply_status::UNCOMPUTED;
+        data.current = data.entries.end();
+        data.failed_args_id.clear();
+    }
+    else if (
+        data.status == apply_status::FAILED
+        && data.failed_args_id.matches(args_id))
+    {
+        // The function already failed on these arguments.
+    }
+    else if (
+        data.current == data.entries.end()
+        || !data.current->args_id.matches(args_id))
+    {
+        // Look for a cached result.
+        auto cached = data.index.find(&args_id);
+        if (cached != data.index.end())
+        {
+            ++data.stats.hits;
+            data.entries.splice(
+                data.entries.begin(), data.entries, cached->second);
+            data.current = data.entries.begin();
+            data.status = apply_status::READY;
+        }
+        else
+        {
+            ++data.stats.misses;
+            try
+            {
+                typename data_type::entry entry{
+                    captured_id(args_id),
+                    f(read_signal(args)...),
+                    0,
+                    data.next_version++};
+                entry.size
+                    = sizeof(entry) + estimate_memoized_size(entry.result);
+                data.entries.push_front(std::move(entry));
+                data.current = data.entries.begin();
+                data.index[&data.current->args_id.get()] = data.current;
+                data.status = apply_status::READY;
+                ++data.stats.entry_count;
+                data.stats.total_bytes += data.current->size;
+                enforce_memoization_limits(data, limits);
+            }
+            catch (...)
+            {
+                data.current = data.entries.end();
+                data.status = apply_status::FAILED;
+                data.failed_args_id.capture(args_id);
+            }
+        }
+    }
+
+    return memoized_apply_signal<result_type>(data);
+}
+
 // alia_mem_fn(m) wraps a member function name in a lambda so that it can be
 // passed as a function object. (It's the equivalent of std::mem_fn, but there's
 // no need to provide the type name.)
@@ -5367,6 +7241,7 @@ lambda_action(Perform perform)
 } // namespace alia
 
 
+#include <algorithm>
 
 namespace alia {
 
@@ -5469,6 +7344,48 @@ for_each(Context ctx, ContainerSignal const& container_signal, Fn&& fn)
     ALIA_END
 }
 
+// for_each_in_window(ctx, container_signal, first, window_size, fn) is like
+// for_each for vector-like containers, but it only invokes :fn for the items
+// with indices in [first, first + window_size) (clipped to the container).
+//
+// This is intended for very long lists where only a window of items is ever
+// visible. Rather than being associated with the items themselves, the data for
+// each invocation of :fn is associated with the item's slot within the window
+// (its index modulo :window_size). As the window slides along the container,
+// the data (and thus any widgets) for the items that slide out is recycled for
+// the items that slide in, so the amount of data is bounded by the window size.
+// This means that any per-item state that should follow an item as the window
+// moves has to live in the container itself.
+template<
+    class Context,
+    class ContainerSignal,
+    class Fn,
+    std::enable_if_t<
+        !is_map_like<typename ContainerSignal::value_type>::value
+            && is_vector_like<typename ContainerSignal::value_type>::value,
+        int> = 0>
+void
+for_each_in_window(
+    Context ctx,
+    ContainerSignal const& container_signal,
+    size_t first,
+    size_t window_size,
+    Fn&& fn)
+{
+    ALIA_IF(has_value(container_signal))
+    {
+        naming_context nc(ctx);
+        auto const& container = read_signal(container_signal);
+        size_t const end = std::min(container.size(), first + window_size);
+        for (size_t index = first; index < end; ++index)
+        {
+            named_block nb(nc, make_id(index % window_size));
+            fn(ctx, container_signal[value(index)]);
+        }
+    }
+    ALIA_END
+}
+
 // signal type for accessing items within a list
 template<class ListSignal, class Item>
 struct list_item_signal : signal<
@@ -5612,12 +7529,42 @@ enum class async_status
     FAILED
 };
 
+// async_cancellation_token lets a task that's computing an async result check
+// whether that result is still wanted. The token is cancelled when the async
+// operation is reset (e.g., because its inputs changed), so long-running tasks
+// should check it periodically and give up early if it's set.
+struct async_cancellation_token
+{
+    async_cancellation_token()
+    {
+    }
+    explicit async_cancellation_token(
+        std::shared_ptr<std::atomic<bool> const> flag)
+        : flag_(std::move(flag))
+    {
+    }
+    bool
+    is_cancelled() const
+    {
+        return flag_ && flag_->load(std::memory_order_relaxed);
+    }
+
+ private:
+    std::shared_ptr<std::atomic<bool> const> flag_;
+};
+
 template<class Value>
 struct async_operation_data
 {
     counter_type version = 0;
     Value result;
     async_status status = async_status::UNREADY;
+    // the cancellation flag for the task that's computing the current version
+    // (if it's been launched with one)
+    std::shared_ptr<std::atomic<bool>> cancellation;
+    // the routing region that's waiting on the result (if any) - This is only
+    // ever touched on the system's thread. (See async_operation_holder.)
+    routing_region_ptr region;
 };
 
 template<class Value>
@@ -5628,9 +7575,35 @@ reset(async_operation_data<Value>& data)
     {
         ++data.version;
         data.status = async_status::UNREADY;
+        if (data.cancellation)
+        {
+            data.cancellation->store(true, std::memory_order_relaxed);
+            data.cancellation.reset();
+        }
     }
 }
 
+// async_operation_holder<Value> is what's actually stored in the data graph
+// for an async operation. The operation data itself is shared with the
+// in-flight task (which may be on another thread), so when the holder goes
+// away, it invalidates that task's result (cancelling the task's token, if it
+// has one) and releases the data's reference to its routing region (which has
+// to happen on the system thread).
+template<class Value>
+struct async_operation_holder : noncopyable
+{
+    std::shared_ptr<async_operation_data<Value>> data;
+
+    ~async_operation_holder()
+    {
+        if (data)
+        {
+            reset(*data);
+            data->region.reset();
+        }
+    }
+};
+
 template<class Value>
 struct async_signal : signal<async_signal<Value>, Value, read_only_signal>
 {
@@ -5703,7 +7676,7 @@ auto
 async(Context ctx, Launcher launcher, Args const&... args)
 {
     std::shared_ptr<async_operation_data<Result>>& data_ptr
-        = get_cached_data<std::shared_ptr<async_operation_data<Result>>>(ctx);
+        = get_cached_data<async_operation_holder<Result>>(ctx).data;
     if (!data_ptr)
         data_ptr.reset(new async_operation_data<Result>);
     auto& data = *data_ptr;
@@ -5714,17 +7687,48 @@ async(Context ctx, Launcher launcher, Args const&... args)
     on_refresh(ctx, [&](auto ctx) {
         if (data.status == async_status::UNREADY && args_ready)
         {
-            auto* system = &get_component<system_tag>(ctx);
+            auto& system = get_component<system_tag>(ctx);
+            // The launcher may report the result after the system is gone,
+            // so it only holds onto the system's completion target.
+            auto target = system.completion_target;
+            bool thread_safe = system.thread_safe_async;
             auto version = data.version;
-            auto report_result = [system, version, data_ptr](Result result) {
-                auto& data = *data_ptr;
-                if (data.version == version)
+            // The region that's waiting on the result has to be refreshed
+            // when it arrives.
+            data.region = get_active_routing_region(ctx);
+            auto report_result = [target, thread_safe, version, data_ptr](
+                                     Result result) {
+                auto deliver = [version, data_ptr](Result& result) {
+                    auto& data = *data_ptr;
+                    if (data.version == version)
+                    {
+                        data.result = std::move(result);
+                        data.status = async_status::COMPLETE;
+                        mark_dirty(data.region.get());
+                    }
+                };
+                if (thread_safe)
+                {
+                    // Hand the result to the system's own thread.
+                    post_to_system_thread(
+                        *target,
+                        [deliver, result = std::move(result)]() mutable {
+                            deliver(result);
+                        });
+                }
+                // Otherwise, results are only reported on the system's own
+                // thread, so the target can be checked without locking. (And
+                // locking could deadlock, since the refresh that this
+                // triggers can report other results.)
+                else if (target->sys)
                 {
-                    data.result = std::move(result);
-                    data.status = async_status::COMPLETE;
+                    deliver(result);
+                    schedule_refresh(*target->sys);
                 }
-                refresh_system(*system);
             };
+            // Mark the operation as launched before invoking the launcher,
+            // since the launcher may report its result immediately.
+            data.status = async_status::LAUNCHED;
             try
             {
                 launcher(ctx, report_result, read_signal(args)...);
@@ -5742,6 +7746,185 @@ async(Context ctx, Launcher launcher, Args const&... args)
 } // namespace alia
 
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// This file provides a simple work-stealing thread pool, parallel_for(), and
+// async_in_pool(), which uses a pool to compute async results off the
+// system's thread.
+
+namespace alia {
+
+// thread_pool runs tasks on a fixed set of worker threads. Each worker has its
+// own task queue. Tasks submitted from a worker go onto that worker's queue
+// (and are run LIFO), while tasks submitted from elsewhere are distributed
+// round-robin. Idle workers steal from the front of other workers' queues.
+//
+// Tasks are expected not to throw. (If one does, the exception is discarded.)
+struct thread_pool : noncopyable
+{
+    // If :thread_count is 0, the number of hardware threads is used.
+    explicit thread_pool(unsigned thread_count = 0);
+    ~thread_pool();
+
+    void
+    submit(std::function<void()> task);
+
+    unsigned
+    thread_count() const
+    {
+        return unsigned(threads_.size());
+    }
+
+ private:
+    struct worker_queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool
+    pop_local_task(unsigned index, std::function<void()>& task);
+
+    bool
+    steal_task(unsigned thief, std::function<void()>& task);
+
+    void
+    run_worker(unsigned index);
+
+    std::vector<std::unique_ptr<worker_queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<unsigned> next_queue_{0};
+    // the number of tasks that have been submitted but not yet started -
+    // This is incremented (while holding :wake_mutex_, so that workers don't
+    // miss wakeups) before a task is published and decremented after one is
+    // taken, so it never drops below the number of queued tasks. A worker
+    // that sees it before the task lands just looks again.
+    std::atomic<size_t> pending_{0};
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+};
+
+// Get the pool that's used by async_in_pool() when the system doesn't have
+// its own. It's created the first time it's requested.
+thread_pool&
+get_default_thread_pool();
+
+// parallel_for(pool, count, body) splits the index range [0, count) into
+// chunks and calls body(begin, end) for each chunk, using the workers of
+// :pool along with the calling thread. It returns once all chunks are done.
+//
+// The calling thread always participates, so this is safe to call from one
+// of the pool's own workers. If :body throws, the first exception is
+// rethrown here (after all chunks have finished).
+void
+parallel_for(
+    thread_pool& pool,
+    std::size_t count,
+    std::function<void(std::size_t begin, std::size_t end)> const& body);
+
+// async_in_pool(ctx, f, args...), where :args are all signals, yields a signal
+// to the result of calling :f on the values of :args on a thread pool. :f is
+// called as f(token, arg_values...), where :token is an
+// async_cancellation_token that's cancelled if :args change before the result
+// is delivered.
+//
+// The pool used is sys.pool if it's set, or the default pool otherwise.
+// Results are always delivered through the system's completion queue, so this
+// relies on the external interface implementing
+// schedule_refresh_from_any_thread().
+//
+template<class Context, class Function, class... Args>
+auto
+async_in_pool(Context ctx, Function f, Args const&... args)
+{
+    typedef std::decay_t<decltype(
+        f(std::declval<async_cancellation_token const&>(),
+          read_signal(args)...))>
+        result_type;
+
+    // The holder invalidates (and cancels) any job that's still in flight
+    // when this block is destroyed.
+    std::shared_ptr<async_operation_data<result_type>>& data_ptr
+        = get_cached_data<async_operation_holder<result_type>>(ctx).data;
+    if (!data_ptr)
+        data_ptr.reset(new async_operation_data<result_type>);
+    auto& data = *data_ptr;
+
+    bool args_ready = true;
+    process_async_args(ctx, data, args_ready, args...);
+
+    on_refresh(ctx, [&](auto ctx) {
+        if (data.status == async_status::UNREADY && args_ready)
+        {
+            auto& system = get_component<system_tag>(ctx);
+            thread_pool& pool
+                = system.pool ? *system.pool : get_default_thread_pool();
+            // The job may outlive the system, so it only holds onto the
+            // system's completion target.
+            auto target = system.completion_target;
+
+            auto version = data.version;
+            // As with async(), the region that's waiting on the result has to
+            // be refreshed when it arrives.
+            data.region = get_active_routing_region(ctx);
+            data.cancellation = std::make_shared<std::atomic<bool>>(false);
+            async_cancellation_token token(data.cancellation);
+            data.status = async_status::LAUNCHED;
+
+            auto job = std::bind(f, std::placeholders::_1, read_signal(args)...);
+            std::shared_ptr<async_operation_data<result_type>> shared_data
+                = data_ptr;
+            pool.submit([target, version, shared_data, token, job]() mutable {
+                if (token.is_cancelled())
+                    return;
+                try
+                {
+                    result_type result = job(token);
+                    if (token.is_cancelled())
+                        return;
+                    post_to_system_thread(
+                        *target,
+                        [version, shared_data, result = std::move(result)]()
+                        mutable {
+                            auto& data = *shared_data;
+                            if (data.version == version)
+                            {
+                                data.result = std::move(result);
+                                data.status = async_status::COMPLETE;
+                                data.cancellation.reset();
+                                mark_dirty(data.region.get());
+                            }
+                        });
+                }
+                catch (...)
+                {
+                    post_to_system_thread(*target, [version, shared_data]() {
+                        auto& data = *shared_data;
+                        if (data.version == version)
+                        {
+                            data.status = async_status::FAILED;
+                            data.cancellation.reset();
+                            mark_dirty(data.region.get());
+                        }
+                    });
+                }
+            });
+        }
+    });
+
+    return make_async_signal(data);
+}
+
+} // namespace alia
+
+
+#include <algorithm>
 #include <utility>
 #include <vector>
 
@@ -5863,17 +8046,144 @@ transform(Context ctx, Container const& container, Function const& f)
         *data, all_items_have_values);
 }
 
-} // namespace alia
+// parallel_transform(ctx, container, f) is similar to transform(), but :f is
+// a pure function of a single item's value (rather than a traversal
+// function), so the items can be mapped concurrently.
+//
+// On refresh events, if the container has changed, the items whose values
+// have changed since they were last mapped are collected and mapped on a
+// thread pool (sys.pool if it's set, or the default pool otherwise). The
+// traversal waits for them, so the result is up-to-date as soon as this
+// returns. :f must be safe to call concurrently.
+//
+// Items are identified by their values, so they're copied and must be
+// comparable. The copies are kept alongside the results and compared directly
+// (and assigned in place when an item changes), so an unchanged item costs a
+// single comparison. The result has a value when the container does and :f
+// didn't throw for any item.
+//
 
+template<class Item, class MappedItem>
+struct parallel_transform_data : mapped_sequence_data<MappedItem>
+{
+    // the item values that the current results were mapped from
+    std::vector<Item> mapped_from;
+    // whether or not :f threw for each item
+    std::vector<bool> failed;
+    std::size_t failure_count = 0;
+};
 
+// the outcome of mapping a single item - The workers write these (rather than
+// writing directly into the data), since they're separate objects even when
+// MappedItem is bool. (std::vector<bool> packs neighbouring items into the
+// same word, so it can't be written concurrently.)
+template<class MappedItem>
+struct parallel_transform_result
+{
+    MappedItem value;
+    bool failed = false;
+};
 
-// This file defines utilities for constructing custom signals via lambda
-// functions.
+template<class Item, class MappedItem, class Container, class Function>
+void
+update_parallel_transform(
+    thread_pool& pool,
+    parallel_transform_data<Item, MappedItem>& data,
+    Container const& container,
+    Function const& f)
+{
+    auto const& items = read_signal(container);
 
-namespace alia {
+    size_t const item_count = items.size();
+    size_t const previous_count = data.mapped_from.size();
+    bool resized = previous_count != item_count;
+    data.mapped_items.resize(item_count);
+    data.failed.resize(item_count);
 
-// lambda_reader(read) creates a read-only signal whose value is determined by
-// calling :read.
+    // Collect the items that need to be (re)mapped.
+    std::vector<std::pair<size_t, Item const*>> dirty;
+    size_t index = 0;
+    for (auto const& item : items)
+    {
+        if (index >= previous_count || !(data.mapped_from[index] == item))
+            dirty.emplace_back(index, &item);
+        ++index;
+    }
+
+    std::vector<parallel_transform_result<MappedItem>> results(dirty.size());
+    parallel_for(pool, dirty.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i != end; ++i)
+        {
+            try
+            {
+                results[i].value = f(*dirty[i].second);
+            }
+            catch (...)
+            {
+                results[i].failed = true;
+            }
+        }
+    });
+
+    data.mapped_from.resize(item_count);
+    for (size_t i = 0; i != dirty.size(); ++i)
+    {
+        size_t const item_index = dirty[i].first;
+        data.mapped_items[item_index] = std::move(results[i].value);
+        data.failed[item_index] = results[i].failed;
+        data.mapped_from[item_index] = *dirty[i].second;
+    }
+    data.failure_count
+        = size_t(std::count(data.failed.begin(), data.failed.end(), true));
+    if (resized || !dirty.empty())
+        ++data.output_version;
+}
+
+template<class Context, class Container, class Function>
+auto
+parallel_transform(Context ctx, Container const& container, Function const& f)
+{
+    typedef std::decay_t<decltype(*read_signal(container).begin())>
+        item_type;
+    typedef std::decay_t<decltype(f(std::declval<item_type const&>()))>
+        mapped_value_type;
+
+    parallel_transform_data<item_type, mapped_value_type>* data;
+    get_cached_data(ctx, &data);
+
+    bool all_items_have_values = false;
+    if (signal_has_value(container))
+    {
+        if (is_refresh_event(ctx)
+            && !data->input_id.matches(container.value_id()))
+        {
+            auto& sys = get_component<system_tag>(ctx);
+            update_parallel_transform(
+                sys.pool ? *sys.pool : get_default_thread_pool(),
+                *data,
+                container,
+                f);
+            data->input_id.capture(container.value_id());
+        }
+        all_items_have_values = data->failure_count == 0
+                                && data->input_id.matches(container.value_id());
+    }
+
+    return mapped_sequence_signal<mapped_value_type>(
+        *data, all_items_have_values);
+}
+
+} // namespace alia
+
+
+
+// This file defines utilities for constructing custom signals via lambda
+// functions.
+
+namespace alia {
+
+// lambda_reader(read) creates a read-only signal whose value is determined by
+// calling :read.
 template<class Value, class Read>
 struct simple_lambda_reader_signal
     : regular_signal<
@@ -6412,7 +8722,11 @@ struct state_holder
 template<class Value>
 struct state_signal : signal<state_signal<Value>, Value, bidirectional_signal>
 {
-    explicit state_signal(state_holder<Value>* s) : state_(s)
+    // :region is the routing region that the state belongs to (if any). It's
+    // marked dirty whenever the state is written.
+    explicit state_signal(
+        state_holder<Value>* s, routing_region* region = nullptr)
+        : state_(s), region_(region)
     {
     }
 
@@ -6445,18 +8759,27 @@ struct state_signal : signal<state_signal<Value>, Value, bidirectional_signal>
     write(Value const& value) const
     {
         state_->set(value);
+        mark_dirty(region_);
+    }
+
+    void
+    move_in(Value&& value) const
+    {
+        state_->set(std::move(value));
+        mark_dirty(region_);
     }
 
  private:
     state_holder<Value>* state_;
+    routing_region* region_;
     mutable simple_id<unsigned> id_;
 };
 
 template<class Value>
 state_signal<Value>
-make_state_signal(state_holder<Value>& state)
+make_state_signal(state_holder<Value>& state, routing_region* region = nullptr)
 {
-    return state_signal<Value>(&state);
+    return state_signal<Value>(&state, region);
 }
 
 // get_state(ctx, initial_value) returns a signal carrying some persistent local
@@ -6475,7 +8798,381 @@ get_state(Context ctx, InitialValue const& initial_value)
     if (!state->is_initialized() && signal_has_value(initial_value_signal))
         state->set(read_signal(initial_value_signal));
 
-    return make_state_signal(*state);
+    return make_state_signal(*state, get_active_routing_region_pointer(ctx));
+}
+
+} // namespace alia
+
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// This file provides state snapshots, which let an application persist
+// selected state and async results across runs. When a state_snapshot is
+// attached to a system (via sys.snapshot), persistent state and persisted
+// async results are seeded from it as they're first visited, and the current
+// values can be written back out (e.g., on exit) with write_snapshot().
+//
+// Values in a snapshot are identified by application-supplied string keys,
+// so the keys must be unique within a snapshot (and stable across runs).
+//
+// The snapshot itself is a compact binary blob, which is expected to be
+// loaded from a file (ideally by memory-mapping it). Only the index of keys is
+// parsed when it's loaded. Values are only decoded when they're needed.
+// Snapshots are meant to be read by the same build of the application that
+// wrote them. (Values are stored in the native byte order, and async results
+// are matched to their arguments via ID hashes.)
+
+namespace alia {
+
+// SERIALIZATION - Values are written to snapshots via
+// write_snapshot_value(out, value) and read back via
+// read_snapshot_value(in, value). Overloads are provided for arithmetic
+// types, std::string and std::vector. Other types can be supported by
+// providing overloads that can be found via ADL.
+
+// snapshot_reader reads values from a region of snapshot data.
+struct snapshot_reader
+{
+    char const* position = nullptr;
+    char const* end = nullptr;
+
+    // Read :size bytes into :destination. If there aren't enough bytes left,
+    // this returns false (and reads nothing).
+    bool
+    read(void* destination, std::size_t size)
+    {
+        if (std::size_t(end - position) < size)
+            return false;
+        std::memcpy(destination, position, size);
+        position += size;
+        return true;
+    }
+};
+
+template<class T>
+std::enable_if_t<std::is_arithmetic<T>::value>
+write_snapshot_value(std::string& out, T value)
+{
+    out.append(reinterpret_cast<char const*>(&value), sizeof(T));
+}
+template<class T>
+std::enable_if_t<std::is_arithmetic<T>::value, bool>
+read_snapshot_value(snapshot_reader& in, T& value)
+{
+    return in.read(&value, sizeof(T));
+}
+
+inline void
+write_snapshot_value(std::string& out, std::string const& value)
+{
+    write_snapshot_value(out, std::uint32_t(value.size()));
+    out += value;
+}
+inline bool
+read_snapshot_value(snapshot_reader& in, std::string& value)
+{
+    std::uint32_t size;
+    if (!read_snapshot_value(in, size)
+        || std::size_t(in.end - in.position) < size)
+    {
+        return false;
+    }
+    value.assign(in.position, size);
+    in.position += size;
+    return true;
+}
+
+template<class T, class Allocator>
+void
+write_snapshot_value(std::string& out, std::vector<T, Allocator> const& value)
+{
+    write_snapshot_value(out, std::uint32_t(value.size()));
+    for (auto const& item : value)
+        write_snapshot_value(out, item);
+}
+template<class T, class Allocator>
+bool
+read_snapshot_value(snapshot_reader& in, std::vector<T, Allocator>& value)
+{
+    std::uint32_t size;
+    if (!read_snapshot_value(in, size))
+        return false;
+    value.clear();
+    for (std::uint32_t i = 0; i != size; ++i)
+    {
+        T item;
+        if (!read_snapshot_value(in, item))
+            return false;
+        value.push_back(std::move(item));
+    }
+    return true;
+}
+
+struct state_snapshot;
+
+// A snapshot_entry is something in the data graph whose value is persisted in
+// a snapshot. Entries are attached to the snapshot when they're created and
+// detach themselves when they're destroyed.
+struct snapshot_entry : noncopyable
+{
+    virtual ~snapshot_entry();
+
+    // Append the entry's current value to :out. If the entry doesn't have a
+    // value (and so shouldn't be written), this returns false (and leaves
+    // :out alone).
+    virtual bool
+    write_value(std::string& out) const = 0;
+
+    state_snapshot* snapshot = nullptr;
+    std::string key;
+    snapshot_entry* prev = nullptr;
+    snapshot_entry* next = nullptr;
+};
+
+struct state_snapshot : noncopyable
+{
+    ~state_snapshot();
+
+    // the values in the loaded snapshot, by key - These point into the data
+    // that was passed to load_snapshot(), so that has to stay alive for as long
+    // as the snapshot might read from it.
+    std::unordered_map<std::string, snapshot_reader> loaded;
+
+    // the list of entries that are attached to this snapshot
+    snapshot_entry* entries = nullptr;
+};
+
+// Load the snapshot data at :data (which has :size bytes) into :snapshot.
+// Note that this only indexes the data, so :data has to outlive :snapshot (or
+// at least its next call to load_snapshot() or clear_loaded_snapshot()).
+// If the data isn't a valid snapshot, this leaves :snapshot empty and returns
+// false.
+bool
+load_snapshot(state_snapshot& snapshot, char const* data, std::size_t size);
+
+// Forget the data that was loaded into :snapshot (e.g., before releasing it).
+void
+clear_loaded_snapshot(state_snapshot& snapshot);
+
+// Append a serialized snapshot to :out. This includes the current values of
+// all attached entries, as well as any loaded values that haven't been
+// claimed by an entry in this run (e.g., because the part of the UI that they
+// belong to was never visited).
+void
+write_snapshot(state_snapshot const& snapshot, std::string& out);
+
+// Attach :entry to :snapshot under :key.
+void
+attach_snapshot_entry(
+    state_snapshot& snapshot, snapshot_entry& entry, std::string key);
+
+// Get a reader for the loaded value of :entry (if there is one).
+// The return value is false if there's no loaded value.
+bool
+find_snapshot_value(snapshot_entry const& entry, snapshot_reader& reader);
+
+// Get the snapshot that's attached to the system that :ctx belongs to (or
+// null if there isn't one).
+template<class Context>
+state_snapshot*
+get_state_snapshot(Context ctx)
+{
+    return get_component<system_tag>(ctx).snapshot;
+}
+
+template<class Value>
+struct persistent_state_node : snapshot_entry
+{
+    state_holder<Value> state;
+
+    bool
+    write_value(std::string& out) const
+    {
+        if (!state.is_initialized())
+            return false;
+        write_snapshot_value(out, state.get());
+        return true;
+    }
+};
+
+// get_persistent_state(ctx, key, initial_value) is like get_state(ctx,
+// initial_value), but the state is persisted under :key in the system's
+// snapshot (if it has one). When the state is first visited, its value is
+// seeded from the snapshot. :initial_value is only used if that fails.
+template<class Context, class Key, class InitialValue>
+auto
+get_persistent_state(
+    Context ctx, Key const& key, InitialValue const& initial_value)
+{
+    auto initial_value_signal = signalize(initial_value);
+    typedef typename decltype(initial_value_signal)::value_type value_type;
+
+    persistent_state_node<value_type>* node;
+    if (get_data(ctx, &node))
+    {
+        if (state_snapshot* snapshot = get_state_snapshot(ctx))
+        {
+            attach_snapshot_entry(*snapshot, *node, std::string(key));
+            snapshot_reader reader;
+            value_type value;
+            if (find_snapshot_value(*node, reader)
+                && read_snapshot_value(reader, value))
+            {
+                node->state.set(std::move(value));
+            }
+        }
+    }
+
+    if (!node->state.is_initialized() && signal_has_value(initial_value_signal))
+        node->state.set(read_signal(initial_value_signal));
+
+    return make_state_signal(
+        node->state, get_active_routing_region_pointer(ctx));
+}
+
+// Combine the hashes of the value IDs of :args (which must all have values).
+inline std::size_t
+hash_signal_ids()
+{
+    return 0;
+}
+template<class Arg, class... Rest>
+std::size_t
+hash_signal_ids(Arg const& arg, Rest const&... rest)
+{
+    return combine_hashes(arg.value_id().hash(), hash_signal_ids(rest...));
+}
+
+template<class Value>
+struct persisted_result_node : snapshot_entry
+{
+    // the last known result and the hash of the argument IDs that it was
+    // computed from
+    bool valid = false;
+    Value value;
+    std::size_t args_hash = 0;
+
+    // the value ID of :result that :value was last copied from
+    captured_id source_id;
+
+    // incremented whenever :value (or its validity) changes
+    counter_type version = 0;
+
+    bool
+    write_value(std::string& out) const
+    {
+        if (!valid)
+            return false;
+        write_snapshot_value(out, std::uint64_t(args_hash));
+        write_snapshot_value(out, value);
+        return true;
+    }
+};
+
+template<class Value>
+struct persisted_result_signal
+    : signal<persisted_result_signal<Value>, Value, read_only_signal>
+{
+    explicit persisted_result_signal(persisted_result_node<Value>& node)
+        : node_(&node)
+    {
+    }
+    bool
+    has_value() const
+    {
+        return node_->valid;
+    }
+    Value const&
+    read() const
+    {
+        return node_->value;
+    }
+    id_interface const&
+    value_id() const
+    {
+        id_ = make_id(node_->version);
+        return id_;
+    }
+
+ private:
+    persisted_result_node<Value>* node_;
+    mutable simple_id<counter_type> id_;
+};
+
+// persist_async_result(ctx, key, result, args...), where :result is the
+// signal produced by an async operation (e.g., async() or async_in_pool())
+// and :args are the signals that were passed to it, persists the result under
+// :key in the system's snapshot (if it has one).
+//
+// The returned signal carries :result when it has a value. Until then, it
+// carries the last known result for the same arguments, which is seeded from
+// the snapshot when this is first visited. So, on a warm start, the UI can
+// show the result from the last run immediately while the fresh one is
+// computed in the background. (This also keeps the last result around while
+// the async operation itself is reset.)
+//
+// Since results are matched to their arguments via the hashes of the
+// arguments' value IDs, those IDs must be based on the arguments' actual
+// values (e.g., via identify_by_hash()) for results to carry across runs.
+template<class Context, class Key, class Result, class... Args>
+auto
+persist_async_result(
+    Context ctx, Key const& key, Result const& result, Args const&... args)
+{
+    typedef typename Result::value_type value_type;
+
+    persisted_result_node<value_type>* node;
+    if (get_data(ctx, &node))
+    {
+        if (state_snapshot* snapshot = get_state_snapshot(ctx))
+        {
+            attach_snapshot_entry(*snapshot, *node, std::string(key));
+            snapshot_reader reader;
+            std::uint64_t args_hash;
+            if (find_snapshot_value(*node, reader)
+                && read_snapshot_value(reader, args_hash)
+                && read_snapshot_value(reader, node->value))
+            {
+                node->args_hash = std::size_t(args_hash);
+                node->valid = true;
+                ++node->version;
+            }
+        }
+    }
+
+    on_refresh(ctx, [&](auto ctx) {
+        if (signal_has_value(result))
+        {
+            // Record each new result.
+            if (!node->source_id.matches(result.value_id()))
+            {
+                node->value = read_signal(result);
+                node->args_hash = hash_signal_ids(args...);
+                node->valid = true;
+                ++node->version;
+                node->source_id.capture(result.value_id());
+            }
+        }
+        else if (node->valid)
+        {
+            // The last known result only stands in for the real one if it
+            // was computed from the same arguments.
+            if (!signals_all_have_values(args...)
+                || node->args_hash != hash_signal_ids(args...))
+            {
+                node->valid = false;
+                ++node->version;
+            }
+        }
+    });
+
+    return add_fallback(result, persisted_result_signal<value_type>(*node));
 }
 
 } // namespace alia
@@ -6849,6 +9546,47 @@ ALIA_DECLARE_STRING_CONVERSIONS(float)
 ALIA_DECLARE_STRING_CONVERSIONS(double)
 ALIA_DECLARE_STRING_CONVERSIONS(std::string)
 
+// number_text is a small inline buffer that holds the text form of a number.
+struct number_text
+{
+    char chars[32];
+    std::size_t length = 0;
+};
+
+// format_number(&text, value) formats value into text exactly as to_string
+// would, but without allocating anything.
+//
+// update_text(&text, value) sets text to the string form of value and returns
+// true iff that actually changed it. For the numeric types, the number is
+// formatted into a number_text first, so if the text hasn't changed, nothing
+// is allocated or copied. For other types, this falls back to to_string.
+//
+#define ALIA_DECLARE_NUMBER_FORMATTING(T)                                      \
+    void format_number(number_text* text, T value);                            \
+    bool update_text(std::string* text, T value);
+
+ALIA_DECLARE_NUMBER_FORMATTING(short int)
+ALIA_DECLARE_NUMBER_FORMATTING(unsigned short int)
+ALIA_DECLARE_NUMBER_FORMATTING(int)
+ALIA_DECLARE_NUMBER_FORMATTING(unsigned int)
+ALIA_DECLARE_NUMBER_FORMATTING(long int)
+ALIA_DECLARE_NUMBER_FORMATTING(unsigned long int)
+ALIA_DECLARE_NUMBER_FORMATTING(long long int)
+ALIA_DECLARE_NUMBER_FORMATTING(unsigned long long int)
+ALIA_DECLARE_NUMBER_FORMATTING(float)
+ALIA_DECLARE_NUMBER_FORMATTING(double)
+
+template<class Value>
+bool
+update_text(std::string* text, Value const& value)
+{
+    std::string new_text = to_string(value);
+    if (new_text == *text)
+        return false;
+    *text = std::move(new_text);
+    return true;
+}
+
 // as_text(ctx, x) creates a text-based interface to the accessor x.
 template<class Readable>
 void
@@ -6897,9 +9635,15 @@ update_bidirectional_text(bidirectional_text_data<Value>* data, Readable x)
             if (!data->output_valid || read_signal(x) != data->input_value)
             {
                 data->input_value = read_signal(x);
-                data->output_text = to_string(read_signal(x));
-                data->output_valid = true;
-                ++data->output_version;
+                // Values that differ can still format to the same text (e.g.,
+                // floats that differ past the displayed precision), and in
+                // that case, the text (and its version) are left alone.
+                if (update_text(&data->output_text, read_signal(x))
+                    || !data->output_valid)
+                {
+                    data->output_valid = true;
+                    ++data->output_version;
+                }
             }
             data->input_id.capture(input_id);
         }
@@ -6987,6 +9731,13 @@ operator<(id_interface const& a, id_interface const& b)
     return typeid(a).before(typeid(b)) || (types_match(a, b) && a.less_than(b));
 }
 
+std::size_t
+make_unique_content_hash()
+{
+    static std::atomic<std::size_t> last_hash{0};
+    return ++last_hash;
+}
+
 void
 clone_into(id_interface*& storage, id_interface const* id)
 {
@@ -7006,6 +9757,47 @@ clone_into(id_interface*& storage, id_interface const* id)
     }
 }
 
+void
+captured_id::clear()
+{
+    if (is_inline())
+        id_->~id_interface();
+    else
+        delete id_;
+    id_ = nullptr;
+}
+
+void
+captured_id::capture(id_interface const& new_id)
+{
+    if (id_ && types_match(*id_, new_id))
+    {
+        new_id.deep_copy(id_);
+        return;
+    }
+    this->clear();
+    id_ = new_id.clone_in_place(&buffer_, inline_capacity);
+    if (!id_)
+        id_ = new_id.clone();
+}
+
+void
+captured_id::take(captured_id& other)
+{
+    if (other.is_inline())
+    {
+        // Inline IDs have to be moved over since they live inside :other.
+        id_ = other.id_->move_in_place(&buffer_, inline_capacity);
+        assert(id_);
+        other.clear();
+    }
+    else
+    {
+        id_ = other.id_;
+        other.id_ = nullptr;
+    }
+}
+
 void
 clone_into(std::shared_ptr<id_interface>& storage, id_interface const* id)
 {
@@ -7081,15 +9873,121 @@ get_default_tick_count()
         .count();
 }
 
-void
-refresh_system(system& sys)
+async_completion_queue::~async_completion_queue()
 {
-    sys.refresh_needed = false;
+    async_completion* completion = head.load();
+    while (completion)
+    {
+        async_completion* next = completion->next;
+        delete completion;
+        completion = next;
+    }
+}
+
+bool
+push_completion(async_completion_queue& queue, async_completion* completion)
+{
+    async_completion* head = queue.head.load(std::memory_order_relaxed);
+    do
+    {
+        completion->next = head;
+    } while (!queue.head.compare_exchange_weak(
+        head, completion, std::memory_order_release, std::memory_order_relaxed));
+    return head == nullptr;
+}
+
+bool
+run_completions(async_completion_queue& queue)
+{
+    async_completion* stack = queue.head.exchange(nullptr);
+    if (!stack)
+        return false;
+
+    async_completion* ordered = nullptr;
+    while (stack)
+    {
+        async_completion* next = stack->next;
+        stack->next = ordered;
+        ordered = stack;
+        stack = next;
+    }
+
+    while (ordered)
+    {
+        std::unique_ptr<async_completion> completion(ordered);
+        ordered = ordered->next;
+        completion->complete();
+    }
+    return true;
+}
+
+system::system()
+    : completion_target(std::make_shared<system_completion_target>())
+{
+    completion_target->sys = this;
+}
+
+system::~system()
+{
+    // Once this returns, no other thread can post to us.
+    std::lock_guard<std::mutex> lock(completion_target->mutex);
+    completion_target->sys = nullptr;
+}
+
+void
+post_completion(system& sys, async_completion* completion)
+{
+    // If the queue was already nonempty, a refresh has already been requested.
+    if (push_completion(sys.completions, completion) && sys.external)
+        sys.external->schedule_refresh_from_any_thread();
+}
+
+void
+refresh_system(system& sys)
+{
+    run_completions(sys.completions);
+
+    sys.refresh_needed = false;
+    sys.full_refresh_needed = false;
+
+    refresh_event refresh;
+    impl::dispatch_event(sys, refresh);
+}
+
+void
+refresh_animation_frame(system& sys)
+{
+    // Completions can change anything, so if any are run, this has to be a
+    // full refresh.
+    if (run_completions(sys.completions))
+        sys.full_refresh_needed = true;
+
+    bool full = sys.full_refresh_needed;
+
+    sys.refresh_needed = false;
+    sys.full_refresh_needed = false;
 
     refresh_event refresh;
+    refresh.animation_frame = !full;
     impl::dispatch_event(sys, refresh);
 }
 
+void
+schedule_refresh(system& sys)
+{
+    sys.refresh_needed = true;
+    sys.full_refresh_needed = true;
+    if (!sys.external || !sys.external->schedule_refresh())
+        refresh_system(sys);
+}
+
+void
+reduce_memory_usage(system& sys, std::size_t budget)
+{
+    if (reduce_memory_usage(sys.data, budget))
+        refresh_system(sys);
+}
+
 } // namespace alia
 
 
@@ -7101,6 +9999,14 @@ request_animation_refresh(dataless_context ctx)
     // Invoke the virtual method on the external system interface.
     // And also set a flag to indicate that a refresh is needed.
     system& sys = get_component<system_tag>(ctx);
+    // The code that's requesting the refresh obviously needs to run again.
+    // If it's not within any region, there's nothing to mark, so the next
+    // frame can't skip anything.
+    routing_region* region = get_active_routing_region_pointer(ctx);
+    if (region)
+        mark_dirty(region);
+    else
+        sys.full_refresh_needed = true;
     if (!sys.refresh_needed)
     {
         if (sys.external)
@@ -7137,27 +10043,38 @@ get_raw_animation_ticks_left(dataless_context ctx, millisecond_count end_time)
 }
 
 } // namespace alia
-#include <map>
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 
 namespace alia {
 
 struct named_block_node;
 
+// naming_map is an open-addressing hash table (with linear probing) that maps
+// IDs to named_block_nodes. The keys are the IDs stored within the nodes
+// themselves, so each slot only needs the node pointer and its (cached) hash.
 struct naming_map
 {
-    typedef std::map<
-        id_interface const*,
-        named_block_node*,
-        id_interface_pointer_less_than_test>
-        map_type;
-    map_type blocks;
+    struct slot
+    {
+        named_block_node* node;
+        std::size_t hash;
+    };
+    // The number of slots is always zero or a power of two.
+    std::vector<slot> slots;
+    // the number of occupied slots
+    std::size_t block_count = 0;
 };
 
 struct named_block_node : noncopyable
 {
     named_block_node()
-        : reference_count(0), active_count(0), manual_delete(false), map(0)
+        : reference_count(0),
+          active_count(0),
+          manual_delete(false),
+          map(0),
+          graph(0)
     {
     }
 
@@ -7167,6 +10084,9 @@ struct named_block_node : noncopyable
     // the ID of the block
     captured_id id;
 
+    // the hash of the ID (as stored in the map)
+    std::size_t id_hash;
+
     // count of references to this block by data_blocks
     int reference_count;
 
@@ -7182,6 +10102,9 @@ struct named_block_node : noncopyable
     // to know where that map is so it can remove itself if it's no longer
     // needed.
     naming_map* map;
+
+    // the graph that this block belongs to
+    data_graph* graph;
 };
 
 // naming_maps are always created via a naming_map_node, which takes care of
@@ -7202,15 +10125,112 @@ struct naming_map_node : noncopyable
     naming_map_node* next;
     naming_map_node* prev;
 };
+
+// Mix the bits of an ID hash so that hashes that only differ in their high
+// bits (e.g., pointers) still spread out across the slots.
+static std::size_t
+get_home_slot(naming_map const& map, std::size_t hash)
+{
+    std::uint64_t h = hash;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return std::size_t(h) & (map.slots.size() - 1);
+}
+
+// Find the slot index of the block with the given ID (or -1 if there is none).
+static std::ptrdiff_t
+find_slot(naming_map const& map, id_interface const& id, std::size_t hash)
+{
+    if (map.slots.empty())
+        return -1;
+    std::size_t mask = map.slots.size() - 1;
+    for (std::size_t i = get_home_slot(map, hash);; i = (i + 1) & mask)
+    {
+        naming_map::slot const& slot = map.slots[i];
+        if (!slot.node)
+            return -1;
+        if (slot.hash == hash && slot.node->id.get() == id)
+            return std::ptrdiff_t(i);
+    }
+}
+
+static named_block_node*
+find_in_naming_map(naming_map const& map, id_interface const& id)
+{
+    std::ptrdiff_t i = find_slot(map, id, id.hash());
+    return i < 0 ? nullptr : map.slots[i].node;
+}
+
+// Place :node in the first free slot along its probe sequence.
+// (This assumes the map has room for it.)
+static void
+place_in_slots(naming_map& map, named_block_node* node)
+{
+    std::size_t mask = map.slots.size() - 1;
+    std::size_t i = get_home_slot(map, node->id_hash);
+    while (map.slots[i].node)
+        i = (i + 1) & mask;
+    map.slots[i].node = node;
+    map.slots[i].hash = node->id_hash;
+}
+
+static void
+insert_into_naming_map(naming_map& map, named_block_node* node)
+{
+    // Keep the load factor at or below 3/4.
+    if ((map.block_count + 1) * 4 > map.slots.size() * 3)
+    {
+        std::vector<naming_map::slot> old_slots(
+            std::max(map.slots.size() * 2, std::size_t(16)),
+            naming_map::slot{nullptr, 0});
+        old_slots.swap(map.slots);
+        for (auto const& slot : old_slots)
+        {
+            if (slot.node)
+                place_in_slots(map, slot.node);
+        }
+    }
+    place_in_slots(map, node);
+    ++map.block_count;
+}
+
+static void
+remove_from_naming_map(naming_map& map, named_block_node* node)
+{
+    std::ptrdiff_t found = find_slot(map, node->id.get(), node->id_hash);
+    assert(found >= 0 && map.slots[found].node == node);
+    // Shift subsequent entries in the probe sequence back to fill the hole
+    // (so that lookups never need tombstones).
+    std::size_t mask = map.slots.size() - 1;
+    std::size_t hole = std::size_t(found);
+    for (std::size_t i = (hole + 1) & mask; map.slots[i].node;
+         i = (i + 1) & mask)
+    {
+        std::size_t home = get_home_slot(map, map.slots[i].hash);
+        // The entry at i can move into the hole unless its home slot lies
+        // (cyclically) within (hole, i].
+        bool stays = hole <= i ? (hole < home && home <= i)
+                               : (hole < home || home <= i);
+        if (!stays)
+        {
+            map.slots[hole] = map.slots[i];
+            hole = i;
+        }
+    }
+    map.slots[hole].node = nullptr;
+    --map.block_count;
+}
+
 naming_map_node::~naming_map_node()
 {
     // Remove the association between any named_blocks left in the map and
     // the map itself.
-    for (naming_map::map_type::const_iterator i = map.blocks.begin();
-         i != map.blocks.end();
-         ++i)
+    for (auto const& slot : map.slots)
     {
-        named_block_node* node = i->second;
+        named_block_node* node = slot.node;
+        if (!node)
+            continue;
         if (node->reference_count == 0)
             delete node;
         else
@@ -7226,6 +10246,44 @@ naming_map_node::~naming_map_node()
         graph->map_list = next;
 }
 
+static void
+add_memory_usage(named_block_node const& node, data_memory_usage& usage)
+{
+    ++usage.named_block_count;
+    usage.structure_bytes += sizeof(named_block_node);
+    add_memory_usage(node.block, usage);
+}
+
+static void
+add_memory_usage(naming_map const& map, data_memory_usage& usage)
+{
+    ++usage.naming_map_count;
+    usage.structure_bytes += map.slots.capacity() * sizeof(naming_map::slot);
+    for (auto const& slot : map.slots)
+    {
+        if (slot.node)
+            add_memory_usage(*slot.node, usage);
+    }
+}
+
+// Named blocks are accounted for through the naming maps that hold them
+// (rather than through the blocks that reference them), so each is only
+// counted once.
+template<>
+struct data_node_traits<naming_map_node>
+{
+    static void
+    clear_cache(naming_map_node&)
+    {
+    }
+
+    static void
+    add_memory_usage(naming_map_node const& node, data_memory_usage& usage)
+    {
+        alia::add_memory_usage(node.map, usage);
+    }
+};
+
 static void
 deactivate(named_block_ref_node& ref);
 
@@ -7238,6 +10296,21 @@ struct named_block_ref_node : noncopyable
     {
         if (node)
         {
+            // If this is the last reference and the graph is collecting
+            // incrementally, queue the block instead of destroying it. Its
+            // cached data is left alone (rather than deactivating it), since
+            // clearing that is a large part of the cost that's being deferred.
+            if (node->reference_count == 1 && node->map && !node->manual_delete
+                && node->graph && node->graph->incremental_gc)
+            {
+                node->reference_count = 0;
+                node->active_count = 0;
+                remove_from_naming_map(*node->map, node);
+                node->map = 0;
+                node->graph->dead_named_blocks.push_back(node);
+                return;
+            }
+
             deactivate(*this);
 
             --node->reference_count;
@@ -7247,7 +10320,7 @@ struct named_block_ref_node : noncopyable
                 {
                     if (!node->manual_delete)
                     {
-                        node->map->blocks.erase(&node->id.get());
+                        remove_from_naming_map(*node->map, node);
                         delete node;
                     }
                     else
@@ -7306,24 +10379,10 @@ delete_named_block_ref_list(named_block_ref_node* head)
 static void
 clear_cached_data(data_node* nodes)
 {
+    // Each node knows whether it holds cached data (or is a data block with
+    // cached data inside it).
     for (data_node* i = nodes; i; i = i->next)
-    {
-        // If this node is cached data, clear it.
-        typed_data_node<cached_data_holder>* caching_node
-            = dynamic_cast<typed_data_node<cached_data_holder>*>(i);
-        if (caching_node)
-        {
-            cached_data_holder& holder = caching_node->value;
-            delete holder.data;
-            holder.data = 0;
-        }
-
-        // If this node is a data block, clear cached data from it.
-        typed_data_node<data_block>* block
-            = dynamic_cast<typed_data_node<data_block>*>(i);
-        if (block)
-            clear_cached_data(block->value);
-    }
+        i->clear_cache();
 }
 
 void
@@ -7343,6 +10402,86 @@ data_block::~data_block()
     clear_data_block(*this);
 }
 
+data_pool::~data_pool()
+{
+    while (chunks)
+    {
+        void* next = *static_cast<void**>(chunks);
+        ::operator delete(chunks);
+        chunks = next;
+    }
+}
+
+void*
+allocate_pooled_data(data_pool& pool, std::size_t size)
+{
+    assert(size != 0 && size <= data_pool::max_size);
+    std::size_t size_class = (size - 1) / data_pool::granularity;
+
+    // Reuse a free node if there is one.
+    void*& free_list = pool.free_lists[size_class];
+    if (free_list)
+    {
+        void* storage = free_list;
+        free_list = *static_cast<void**>(storage);
+        return storage;
+    }
+
+    // Otherwise, carve it out of the current chunk (starting a new one if
+    // there's not enough room left).
+    std::size_t rounded_size = (size_class + 1) * data_pool::granularity;
+    if (std::size_t(pool.chunk_end - pool.chunk_cursor) < rounded_size)
+    {
+        char* chunk
+            = static_cast<char*>(::operator new(data_pool::chunk_size));
+        *reinterpret_cast<void**>(chunk) = pool.chunks;
+        pool.chunks = chunk;
+        // The first slot holds the chunk link.
+        pool.chunk_cursor = chunk + data_pool::granularity;
+        pool.chunk_end = chunk + data_pool::chunk_size;
+    }
+    void* storage = pool.chunk_cursor;
+    pool.chunk_cursor += rounded_size;
+    return storage;
+}
+
+void
+free_pooled_data(data_pool& pool, void* storage, std::size_t size)
+{
+    std::size_t size_class = (size - 1) / data_pool::granularity;
+    void*& free_list = pool.free_lists[size_class];
+    *static_cast<void**>(storage) = free_list;
+    free_list = storage;
+}
+
+// Destroy all named blocks that are queued for destruction in :graph.
+static void
+destroy_dead_named_blocks(data_graph& graph)
+{
+    while (!graph.dead_named_blocks.empty())
+    {
+        named_block_node* node = graph.dead_named_blocks.back();
+        graph.dead_named_blocks.pop_back();
+        delete node;
+    }
+}
+
+data_graph::~data_graph()
+{
+    // Destroy everything directly, including anything that's still queued.
+    incremental_gc = false;
+    clear_data_block(root_block);
+    destroy_dead_named_blocks(*this);
+}
+
+void
+enable_data_pool(data_graph& graph)
+{
+    assert(!graph.root_block.nodes);
+    if (!graph.pool)
+        graph.pool.reset(new data_pool);
+}
+
 void
 clear_data_block(data_block& block)
 {
@@ -7350,7 +10489,7 @@ clear_data_block(data_block& block)
     while (node)
     {
         data_node* next = node->next;
-        delete node;
+        node->release(block.pool);
         node = next;
     }
     block.nodes = 0;
@@ -7361,6 +10500,118 @@ clear_data_block(data_block& block)
     block.cache_clear = true;
 }
 
+profiling_counters&
+operator+=(profiling_counters& a, profiling_counters const& b)
+{
+    a.data_nodes += b.data_nodes;
+    a.new_data_nodes += b.new_data_nodes;
+    a.data_blocks += b.data_blocks;
+    a.predicted_named_blocks += b.predicted_named_blocks;
+    a.mapped_named_blocks += b.mapped_named_blocks;
+    a.new_named_blocks += b.new_named_blocks;
+    a.layout_updates += b.layout_updates;
+    return a;
+}
+
+profiling_counters
+operator-(profiling_counters const& a, profiling_counters const& b)
+{
+    profiling_counters difference;
+    difference.data_nodes = a.data_nodes - b.data_nodes;
+    difference.new_data_nodes = a.new_data_nodes - b.new_data_nodes;
+    difference.data_blocks = a.data_blocks - b.data_blocks;
+    difference.predicted_named_blocks
+        = a.predicted_named_blocks - b.predicted_named_blocks;
+    difference.mapped_named_blocks
+        = a.mapped_named_blocks - b.mapped_named_blocks;
+    difference.new_named_blocks = a.new_named_blocks - b.new_named_blocks;
+    difference.layout_updates = a.layout_updates - b.layout_updates;
+    return difference;
+}
+
+std::int64_t
+traversal_profiler::now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - epoch_)
+        .count();
+}
+
+std::size_t
+traversal_profiler::begin_span(char const* name, char const* category)
+{
+    if (spans.size() >= max_spans)
+        return no_span;
+    spans.push_back({name, category, now(), -1, totals});
+    return spans.size() - 1;
+}
+
+void
+traversal_profiler::end_span(std::size_t index)
+{
+    // (The span may be gone if the profiler was reset while it was open.)
+    if (index >= spans.size())
+        return;
+    profiling_span& span = spans[index];
+    span.duration = now() - span.start;
+    span.counters = totals - span.counters;
+}
+
+void
+traversal_profiler::reset()
+{
+    totals = profiling_counters();
+    last_traversal = profiling_counters();
+    spans.clear();
+}
+
+static void
+write_json_string(std::ostream& out, char const* text)
+{
+    out << '"';
+    for (char const* c = text; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+            out << '\\' << *c;
+        else if (static_cast<unsigned char>(*c) >= 0x20)
+            out << *c;
+    }
+    out << '"';
+}
+
+void
+write_chrome_trace(std::ostream& out, traversal_profiler const& profiler)
+{
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    for (auto const& span : profiler.spans)
+    {
+        // Skip spans that are still open.
+        if (span.duration < 0)
+            continue;
+        if (!first)
+            out << ',';
+        first = false;
+        out << "\n{\"name\":";
+        write_json_string(out, span.name);
+        out << ",\"cat\":";
+        write_json_string(out, span.category);
+        // Times are in microseconds.
+        out << ",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+            << ",\"ts\":" << double(span.start) / 1000
+            << ",\"dur\":" << double(span.duration) / 1000;
+        profiling_counters const& c = span.counters;
+        out << ",\"args\":{\"data_nodes\":" << c.data_nodes
+            << ",\"new_data_nodes\":" << c.new_data_nodes
+            << ",\"data_blocks\":" << c.data_blocks
+            << ",\"predicted_named_blocks\":" << c.predicted_named_blocks
+            << ",\"mapped_named_blocks\":" << c.mapped_named_blocks
+            << ",\"new_named_blocks\":" << c.new_named_blocks
+            << ",\"layout_updates\":" << c.layout_updates << "}}";
+    }
+    out << "\n]}\n";
+}
+
 void
 scoped_data_block::begin(data_traversal& traversal, data_block& block)
 {
@@ -7379,6 +10630,15 @@ scoped_data_block::begin(data_traversal& traversal, data_block& block)
     traversal.next_data_ptr = &block.nodes;
 
     block.cache_clear = false;
+    block.pool = traversal.graph->pool.get();
+
+    profiling_span_ = traversal_profiler::no_span;
+    if (traversal_profiler* profiler = traversal.profiler)
+    {
+        ++profiler->totals.data_blocks;
+        if (profiler->record_data_blocks)
+            profiling_span_ = profiler->begin_span("data block", "block");
+    }
 }
 void
 scoped_data_block::end()
@@ -7401,6 +10661,9 @@ scoped_data_block::end()
         traversal.named_block_next_ptr = old_named_block_next_ptr_;
         traversal.next_data_ptr = old_next_data_ptr_;
 
+        if (traversal.profiler)
+            traversal.profiler->end_span(profiling_span_);
+
         traversal_ = 0;
     }
 }
@@ -7454,29 +10717,38 @@ find_named_block(
         traversal.predicted_named_block = predicted->next;
         if (traversal.gc_enabled)
             record_usage(traversal, predicted);
+        if (traversal.profiler)
+            ++traversal.profiler->totals.predicted_named_blocks;
         return predicted->node;
     }
 
     if (!traversal.gc_enabled)
         throw named_block_out_of_order();
 
-    // Otherwise, look it up in the map.
-    naming_map::map_type::const_iterator i = map.blocks.find(&id);
+    if (traversal.profiler)
+        ++traversal.profiler->totals.mapped_named_blocks;
 
+    // Otherwise, look it up in the map.
+    std::size_t hash = id.hash();
+    std::ptrdiff_t i = find_slot(map, id, hash);
+    named_block_node* node;
+    if (i >= 0)
+    {
+        node = map.slots[i].node;
+    }
     // If it's not already in the map, create it and insert it.
-    if (i == map.blocks.end())
+    else
     {
-        named_block_node* new_node = new named_block_node;
-        new_node->id.capture(id);
-        new_node->map = &map;
-        new_node->manual_delete = manual.value;
-        i = map.blocks
-                .insert(naming_map::map_type::value_type(
-                    &new_node->id.get(), new_node))
-                .first;
+        node = new named_block_node;
+        node->id.capture(id);
+        node->id_hash = hash;
+        node->map = &map;
+        node->graph = traversal.graph;
+        node->manual_delete = manual.value;
+        insert_into_naming_map(map, node);
+        if (traversal.profiler)
+            ++traversal.profiler->totals.new_named_blocks;
     }
-
-    named_block_node* node = i->second;
     assert(node && node->map == &map);
 
     // Create a new reference node to record the node's usage within this
@@ -7511,10 +10783,9 @@ delete_named_block(data_graph& graph, id_interface const& id)
 {
     for (naming_map_node* i = graph.map_list; i; i = i->next)
     {
-        naming_map::map_type::const_iterator j = i->map.blocks.find(&id);
-        if (j != i->map.blocks.end())
+        named_block_node* node = find_in_naming_map(i->map, id);
+        if (node)
         {
-            named_block_node* node = j->second;
             // If the reference count is nonzero, the block is still active,
             // so we don't want to delete it. We just want to clear the
             // manual_delete flag.
@@ -7524,7 +10795,7 @@ delete_named_block(data_graph& graph, id_interface const& id)
             }
             else
             {
-                i->map.blocks.erase(&id);
+                remove_from_naming_map(i->map, node);
                 node->map = 0;
                 delete node;
             }
@@ -7538,6 +10809,102 @@ disable_gc(data_traversal& traversal)
     traversal.gc_enabled = false;
 }
 
+std::size_t
+collect_dead_named_blocks(
+    data_graph& graph, std::chrono::steady_clock::duration budget)
+{
+    auto const end = std::chrono::steady_clock::now() + budget;
+    do
+    {
+        if (graph.dead_named_blocks.empty())
+            break;
+        // Take the block out of the queue before destroying it, since that
+        // can queue more blocks.
+        named_block_node* node = graph.dead_named_blocks.back();
+        graph.dead_named_blocks.pop_back();
+        delete node;
+    } while (std::chrono::steady_clock::now() < end);
+    return graph.dead_named_blocks.size();
+}
+
+data_memory_usage&
+operator+=(data_memory_usage& a, data_memory_usage const& b)
+{
+    a.node_count += b.node_count;
+    a.node_bytes += b.node_bytes;
+    a.cached_bytes += b.cached_bytes;
+    a.block_count += b.block_count;
+    a.named_block_count += b.named_block_count;
+    a.naming_map_count += b.naming_map_count;
+    a.structure_bytes += b.structure_bytes;
+    return a;
+}
+
+void
+add_memory_usage(data_block const& block, data_memory_usage& usage)
+{
+    ++usage.block_count;
+    for (data_node* i = block.nodes; i; i = i->next)
+        i->add_memory_usage(usage);
+    for (named_block_ref_node* i = block.named_blocks; i; i = i->next)
+        usage.structure_bytes += sizeof(named_block_ref_node);
+}
+
+data_memory_usage
+get_memory_usage(data_graph const& graph)
+{
+    data_memory_usage usage;
+    add_memory_usage(graph.root_block, usage);
+    // Blocks that are queued for destruction aren't in any map anymore.
+    for (named_block_node const* node : graph.dead_named_blocks)
+        add_memory_usage(*node, usage);
+    return usage;
+}
+
+data_memory_usage
+get_named_block_memory_usage(data_graph const& graph, id_interface const& id)
+{
+    data_memory_usage usage;
+    for (naming_map_node const* i = graph.map_list; i; i = i->next)
+    {
+        named_block_node const* node = find_in_naming_map(i->map, id);
+        if (node)
+            add_memory_usage(*node, usage);
+    }
+    return usage;
+}
+
+std::vector<naming_map_memory_usage>
+get_naming_map_memory_usage(data_graph const& graph)
+{
+    std::vector<naming_map_memory_usage> maps;
+    for (naming_map_node const* i = graph.map_list; i; i = i->next)
+    {
+        naming_map_memory_usage map{&i->map, data_memory_usage()};
+        add_memory_usage(i->map, map.usage);
+        maps.push_back(map);
+    }
+    return maps;
+}
+
+bool
+reduce_memory_usage(data_graph& graph, std::size_t budget)
+{
+    if (get_total_bytes(get_memory_usage(graph)) <= budget)
+        return false;
+
+    // Queued blocks are garbage anyway, so try getting rid of them first.
+    if (!graph.dead_named_blocks.empty())
+    {
+        destroy_dead_named_blocks(graph);
+        if (get_total_bytes(get_memory_usage(graph)) <= budget)
+            return false;
+    }
+
+    clear_cached_data(graph.root_block);
+    return true;
+}
+
 void
 scoped_cache_clearing_disabler::begin(data_traversal& traversal)
 {
@@ -7595,6 +10962,7 @@ scoped_routing_region::begin(context ctx)
 
     parent_ = traversal.active_region;
     traversal.active_region = region;
+    region_ = region->get();
 
     if (traversal.targeted)
     {
@@ -7623,12 +10991,144 @@ scoped_routing_region::end()
     }
 }
 
+void
+mark_dirty(routing_region* region)
+{
+    // Note that this always goes all the way to the root (rather than
+    // stopping at the first region that's already dirty) since a dirty region
+    // may have been left untouched while its parent was refreshed.
+    for (; region; region = region->parent.get())
+        region->dirty = true;
+}
+
+bool
+pure_component_block::begin(context ctx, id_interface const& args_id)
+{
+    // This is cached so that, if the component's data is cleared, its content
+    // is guaranteed to be regenerated.
+    captured_id* last_args_id;
+    get_cached_data(ctx, &last_args_id);
+    data_block& block = get_data<data_block>(ctx);
+
+    region_.begin(ctx);
+
+    bool invoke;
+    if (is_refresh_event(ctx))
+    {
+        routing_region& region = *region_.region();
+        invoke = region.dirty || !last_args_id->matches(args_id);
+        if (invoke)
+        {
+            last_args_id->capture(args_id);
+            // This is cleared before the content is traversed so that any
+            // changes made during the traversal itself are recorded.
+            region.dirty = false;
+        }
+    }
+    else
+    {
+        invoke = region_.is_relevant();
+    }
+
+    if (invoke)
+        block_.begin(get_data_traversal(ctx), block);
+    return invoke;
+}
+
+void
+pure_component_block::end()
+{
+    block_.end();
+    region_.end();
+}
+
+bool
+frame_region_block::begin(context ctx)
+{
+    data_block& block = get_data<data_block>(ctx);
+
+    region_.begin(ctx);
+
+    bool invoke = true;
+    refresh_event* refresh;
+    if (detect_event(ctx, &refresh))
+    {
+        routing_region& region = *region_.region();
+        if (refresh->animation_frame)
+        {
+            invoke = region.dirty;
+            if (invoke)
+            {
+                // Everything within this region is refreshed normally.
+                refresh->animation_frame = false;
+                frame_refresh_ = refresh;
+            }
+        }
+        // This is cleared before the content is traversed so that any changes
+        // made during the traversal itself are recorded.
+        if (invoke)
+            region.dirty = false;
+    }
+
+    if (invoke)
+        block_.begin(get_data_traversal(ctx), block);
+    return invoke;
+}
+
+void
+frame_region_block::end()
+{
+    block_.end();
+    region_.end();
+    if (frame_refresh_)
+    {
+        frame_refresh_->animation_frame = true;
+        frame_refresh_ = nullptr;
+    }
+}
+
+namespace {
+
+// scoped_traversal_profile records a traversal as a span and updates the
+// profiler's counters for the last traversal when it's done.
+struct scoped_traversal_profile : noncopyable
+{
+    scoped_traversal_profile(traversal_profiler* profiler, char const* name)
+        : profiler_(profiler)
+    {
+        if (profiler)
+        {
+            initial_totals_ = profiler->totals;
+            span_ = profiler->begin_span(name, "traversal");
+        }
+    }
+    ~scoped_traversal_profile()
+    {
+        if (profiler_)
+        {
+            profiler_->end_span(span_);
+            profiler_->last_traversal = profiler_->totals - initial_totals_;
+        }
+    }
+
+ private:
+    traversal_profiler* profiler_;
+    profiling_counters initial_totals_;
+    std::size_t span_;
+};
+
+} // namespace
+
 static void
 invoke_controller(system& sys, event_traversal& events)
 {
     bool is_refresh = (events.event_type == &typeid(refresh_event));
 
+    scoped_traversal_profile profile(
+        sys.profiler, is_refresh ? "refresh" : "event");
+
     data_traversal data;
+    data.profiler = sys.profiler;
     scoped_data_traversal sdt(sys.data, data);
     // Only use refresh events to decide when data is no longer needed.
     data.gc_enabled = data.cache_clearing_enabled = is_refresh;
@@ -7645,33 +11145,40 @@ invoke_controller(system& sys, event_traversal& events)
 
 namespace impl {
 
-static void
-route_event_(system& sys, event_traversal& traversal, routing_region* target)
+void
+route_event(system& sys, event_traversal& traversal, routing_region* target)
 {
     // In order to construct the path to the target, we start at the target and
-    // follow the 'parent' pointers until we reach the root.
-    // We do this via recursion so that the path can be constructed entirely
-    // on the stack.
-    if (target)
+    // follow the 'parent' pointers until we reach the root. The path is
+    // normally stored in a fixed-size buffer on the stack, but really deep
+    // paths spill over onto the heap.
+    size_t depth = 0;
+    for (routing_region* r = target; r; r = r->parent.get())
+        ++depth;
+
+    event_routing_path inline_path[32];
+    std::vector<event_routing_path> heap_path;
+    event_routing_path* path = inline_path;
+    if (depth > sizeof(inline_path) / sizeof(inline_path[0]))
     {
-        event_routing_path path_node;
-        path_node.rest = traversal.path_to_target;
-        path_node.node = target;
-        traversal.path_to_target = &path_node;
-        route_event_(sys, traversal, target->parent.get());
+        heap_path.resize(depth);
+        path = heap_path.data();
     }
-    else
+
+    // The path is a linked list starting at the root, so each node links to
+    // the one that was added before it (i.e., the one below it).
+    routing_region* r = target;
+    for (size_t i = 0; i != depth; ++i, r = r->parent.get())
     {
-        invoke_controller(sys, traversal);
+        path[i].node = r;
+        path[i].rest = i == 0 ? traversal.path_to_target : &path[i - 1];
     }
-}
+    if (depth != 0)
+        traversal.path_to_target = &path[depth - 1];
 
-void
-route_event(system& sys, event_traversal& traversal, routing_region* target)
-{
     try
     {
-        route_event_(sys, traversal, target);
+        invoke_controller(sys, traversal);
     }
     catch (traversal_aborted&)
     {
@@ -7680,6 +11187,20 @@ route_event(system& sys, event_traversal& traversal, routing_region* target)
 
 } // namespace impl
 
+void
+dispatch_batch(system& sys, event_batch const& batch)
+{
+    for (auto const& event : batch.events())
+    {
+        event_traversal traversal;
+        traversal.targeted = event->targeted;
+        traversal.event_type = &event->type();
+        traversal.event = event->event();
+        impl::route_event(sys, traversal, event->region.get());
+    }
+    schedule_refresh(sys);
+}
+
 void abort_traversal(dataless_context)
 {
     throw traversal_aborted();
@@ -7822,14 +11343,56 @@ eval_curve_at_x(unit_cubic_bezier const& curve, double x, double epsilon)
 
 } // namespace alia
 
+#include <algorithm>
+#include <cctype>
+#include <clocale>
+#include <cstdio>
+#include <cstring>
 #include <sstream>
 
+#if (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)) \
+    && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+// std::to_chars and std::from_chars (including their floating point
+// overloads) are only available in C++17 standard libraries that support
+// them. Elsewhere, numbers are formatted with snprintf and parsed with
+// streams.
+#ifdef __cpp_lib_to_chars
+#define ALIA_USE_CHARCONV
+#endif
+
 namespace alia {
 
 template<class T>
 bool
 string_to_value(std::string const& str, T* value)
 {
+#ifdef ALIA_USE_CHARCONV
+    // Accept the same surrounding whitespace and leading '+' that a stream
+    // would.
+    char const* first = str.data();
+    char const* last = first + str.size();
+    while (first != last && std::isspace(static_cast<unsigned char>(*first)))
+        ++first;
+    while (last != first && std::isspace(static_cast<unsigned char>(last[-1])))
+        --last;
+    if (first != last && *first == '+')
+    {
+        ++first;
+        if (first != last && *first == '-')
+            return false;
+    }
+    T x;
+    auto result = std::from_chars(first, last, x);
+    if (result.ec != std::errc() || result.ptr != last)
+        return false;
+    *value = x;
+    return true;
+#else
     std::istringstream s(str);
     T x;
     if (!(s >> x))
@@ -7841,17 +11404,92 @@ string_to_value(std::string const& str, T* value)
         return true;
     }
     return false;
+#endif
 }
 
 template<class T>
-std::string
-value_to_string(T const& value)
+void
+format_integer(number_text* text, T value)
+{
+#ifdef ALIA_USE_CHARCONV
+    auto result = std::to_chars(
+        text->chars, text->chars + sizeof(text->chars), value);
+    text->length = std::size_t(result.ptr - text->chars);
+#else
+    // Write the digits backwards from the end of the buffer and then move them
+    // to the front.
+    char* end = text->chars + sizeof(text->chars);
+    char* p = end;
+    bool negative = std::is_signed<T>::value && value < T();
+    // Negate in unsigned arithmetic so that the minimum value works.
+    unsigned long long n = static_cast<unsigned long long>(value);
+    if (negative)
+        n = 0 - n;
+    do
+    {
+        *--p = char('0' + n % 10);
+        n /= 10;
+    } while (n != 0);
+    if (negative)
+        *--p = '-';
+    text->length = std::size_t(end - p);
+    std::memmove(text->chars, p, text->length);
+#endif
+}
+
+template<class T>
+void
+format_float(number_text* text, T value)
+{
+    // This matches the default formatting of streams (i.e., %g with six
+    // significant digits).
+#ifdef ALIA_USE_CHARCONV
+    auto result = std::to_chars(
+        text->chars,
+        text->chars + sizeof(text->chars),
+        value,
+        std::chars_format::general,
+        6);
+    text->length = std::size_t(result.ptr - text->chars);
+#else
+    int length = std::snprintf(
+        text->chars, sizeof(text->chars), "%g", static_cast<double>(value));
+    text->length = length > 0 ? std::size_t(length) : 0;
+    // snprintf uses the C locale's decimal point, but streams (and
+    // std::to_chars) always use '.'.
+    char point = *std::localeconv()->decimal_point;
+    if (point != '.')
+        std::replace(text->chars, text->chars + text->length, point, '.');
+#endif
+}
+
+inline bool
+update_number_text(std::string* text, number_text const& formatted)
 {
-    std::ostringstream s;
-    s << value;
-    return s.str();
+    if (text->size() == formatted.length
+        && std::memcmp(text->data(), formatted.chars, formatted.length) == 0)
+    {
+        return false;
+    }
+    // This reuses the string's existing capacity where possible.
+    text->assign(formatted.chars, formatted.length);
+    return true;
 }
 
+#define ALIA_NUMBER_TEXT_CONVERSIONS(T)                                        \
+    std::string to_string(T value)                                             \
+    {                                                                          \
+        number_text text;                                                      \
+        format_number(&text, value);                                           \
+        return std::string(text.chars, text.length);                           \
+    }                                                                          \
+    bool update_text(std::string* text, T value)                               \
+    {                                                                          \
+        number_text formatted;                                                 \
+        format_number(&formatted, value);                                      \
+        return update_number_text(text, formatted);                            \
+    }
+
 template<class T>
 void
 float_from_string(T* value, std::string const& str)
@@ -7865,10 +11503,11 @@ float_from_string(T* value, std::string const& str)
     {                                                                          \
         float_from_string(value, str);                                         \
     }                                                                          \
-    std::string to_string(T value)                                             \
+    void format_number(number_text* text, T value)                             \
     {                                                                          \
-        return value_to_string(value);                                         \
-    }
+        format_float(text, value);                                             \
+    }                                                                          \
+    ALIA_NUMBER_TEXT_CONVERSIONS(T)
 
 ALIA_FLOAT_CONVERSIONS(float)
 ALIA_FLOAT_CONVERSIONS(double)
@@ -7904,20 +11543,22 @@ unsigned_integer_from_string(T* value, std::string const& str)
     {                                                                          \
         signed_integer_from_string(value, str);                                \
     }                                                                          \
-    std::string to_string(T value)                                             \
+    void format_number(number_text* text, T value)                             \
     {                                                                          \
-        return value_to_string(value);                                         \
-    }
+        format_integer(text, value);                                           \
+    }                                                                          \
+    ALIA_NUMBER_TEXT_CONVERSIONS(T)
 
 #define ALIA_UNSIGNED_INTEGER_CONVERSIONS(T)                                   \
     void from_string(T* value, std::string const& str)                         \
     {                                                                          \
         unsigned_integer_from_string(value, str);                              \
     }                                                                          \
-    std::string to_string(T value)                                             \
+    void format_number(number_text* text, T value)                             \
     {                                                                          \
-        return value_to_string(value);                                         \
-    }
+        format_integer(text, value);                                           \
+    }                                                                          \
+    ALIA_NUMBER_TEXT_CONVERSIONS(T)
 
 ALIA_SIGNED_INTEGER_CONVERSIONS(short int)
 ALIA_UNSIGNED_INTEGER_CONVERSIONS(unsigned short int)
@@ -7939,6 +11580,366 @@ to_string(std::string value)
     return value;
 }
 
+} // namespace alia
+#include <algorithm>
+
+namespace alia {
+
+namespace {
+
+// the pool and queue index of the worker running on the current thread (if
+// any)
+thread_local thread_pool* current_pool = nullptr;
+thread_local unsigned current_worker_index = 0;
+
+} // namespace
+
+thread_pool::thread_pool(unsigned thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    for (unsigned i = 0; i != thread_count; ++i)
+        queues_.emplace_back(new worker_queue);
+    for (unsigned i = 0; i != thread_count; ++i)
+        threads_.emplace_back([this, i] { run_worker(i); });
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_)
+        thread.join();
+}
+
+void
+thread_pool::submit(std::function<void()> task)
+{
+    unsigned index = current_pool == this
+                         ? current_worker_index
+                         : next_queue_++ % unsigned(queues_.size());
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        ++pending_;
+    }
+    {
+        worker_queue& queue = *queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    wake_.notify_one();
+}
+
+bool
+thread_pool::pop_local_task(unsigned index, std::function<void()>& task)
+{
+    worker_queue& queue = *queues_[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool
+thread_pool::steal_task(unsigned thief, std::function<void()>& task)
+{
+    unsigned const count = unsigned(queues_.size());
+    for (unsigned offset = 1; offset != count; ++offset)
+    {
+        worker_queue& queue = *queues_[(thief + offset) % count];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+thread_pool::run_worker(unsigned index)
+{
+    current_pool = this;
+    current_worker_index = index;
+    while (true)
+    {
+        std::function<void()> task;
+        if (pop_local_task(index, task) || steal_task(index, task))
+        {
+            --pending_;
+            try
+            {
+                task();
+            }
+            catch (...)
+            {
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        wake_.wait(lock, [&] { return stopping_ || pending_ != 0; });
+        if (stopping_ && pending_ == 0)
+            return;
+    }
+}
+
+thread_pool&
+get_default_thread_pool()
+{
+    static thread_pool pool;
+    return pool;
+}
+
+namespace {
+
+// the state shared by the threads working on a parallel_for() call - Workers
+// that only start after all chunks have been claimed still read this, so it's
+// reference counted. (:body is only accessed while a chunk is claimed, which
+// the caller waits for.)
+struct parallel_for_state
+{
+    std::function<void(std::size_t, std::size_t)> const* body;
+    std::size_t count;
+    std::size_t chunk_count;
+    std::atomic<std::size_t> next_chunk{0};
+    std::atomic<std::size_t> finished_chunks{0};
+    std::mutex mutex;
+    std::condition_variable done;
+    std::exception_ptr error;
+};
+
+void
+run_parallel_for_chunks(parallel_for_state& state)
+{
+    while (true)
+    {
+        std::size_t chunk = state.next_chunk++;
+        if (chunk >= state.chunk_count)
+            return;
+        std::size_t begin = state.count * chunk / state.chunk_count;
+        std::size_t end = state.count * (chunk + 1) / state.chunk_count;
+        try
+        {
+            (*state.body)(begin, end);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (!state.error)
+                state.error = std::current_exception();
+        }
+        if (++state.finished_chunks == state.chunk_count)
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.done.notify_all();
+        }
+    }
+}
+
+} // namespace
+
+void
+parallel_for(
+    thread_pool& pool,
+    std::size_t count,
+    std::function<void(std::size_t begin, std::size_t end)> const& body)
+{
+    // Use a few chunks per thread so that uneven chunks balance out.
+    std::size_t chunk_count
+        = std::min(count, std::size_t(pool.thread_count() + 1) * 4);
+    if (chunk_count <= 1)
+    {
+        if (count != 0)
+            body(0, count);
+        return;
+    }
+
+    auto state = std::make_shared<parallel_for_state>();
+    state->body = &body;
+    state->count = count;
+    state->chunk_count = chunk_count;
+
+    std::size_t helper_count
+        = std::min(std::size_t(pool.thread_count()), chunk_count - 1);
+    for (std::size_t i = 0; i != helper_count; ++i)
+        pool.submit([state] { run_parallel_for_chunks(*state); });
+    run_parallel_for_chunks(*state);
+
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->done.wait(
+            lock, [&] { return state->finished_chunks == chunk_count; });
+    }
+    if (state->error)
+        std::rethrow_exception(state->error);
+}
+
+} // namespace alia
+
+namespace alia {
+
+namespace {
+
+char const snapshot_magic[8] = {'A', 'L', 'I', 'A', 'S', 'N', 'A', 'P'};
+std::uint32_t const snapshot_format_version = 1;
+
+void
+detach_snapshot_entry(snapshot_entry& entry)
+{
+    state_snapshot& snapshot = *entry.snapshot;
+    if (entry.next)
+        entry.next->prev = entry.prev;
+    if (entry.prev)
+        entry.prev->next = entry.next;
+    else
+        snapshot.entries = entry.next;
+    entry.snapshot = nullptr;
+    entry.prev = entry.next = nullptr;
+}
+
+} // namespace
+
+snapshot_entry::~snapshot_entry()
+{
+    if (snapshot)
+        detach_snapshot_entry(*this);
+}
+
+state_snapshot::~state_snapshot()
+{
+    while (entries)
+        detach_snapshot_entry(*entries);
+}
+
+bool
+load_snapshot(state_snapshot& snapshot, char const* data, std::size_t size)
+{
+    clear_loaded_snapshot(snapshot);
+
+    snapshot_reader in;
+    in.position = data;
+    in.end = data + size;
+
+    char magic[sizeof(snapshot_magic)];
+    std::uint32_t version, entry_count;
+    if (!in.read(magic, sizeof(magic))
+        || std::memcmp(magic, snapshot_magic, sizeof(magic)) != 0
+        || !read_snapshot_value(in, version)
+        || version != snapshot_format_version
+        || !read_snapshot_value(in, entry_count))
+    {
+        return false;
+    }
+
+    for (std::uint32_t i = 0; i != entry_count; ++i)
+    {
+        std::string key;
+        std::uint32_t value_size;
+        if (!read_snapshot_value(in, key)
+            || !read_snapshot_value(in, value_size)
+            || std::size_t(in.end - in.position) < value_size)
+        {
+            clear_loaded_snapshot(snapshot);
+            return false;
+        }
+        snapshot_reader value;
+        value.position = in.position;
+        value.end = in.position + value_size;
+        snapshot.loaded[std::move(key)] = value;
+        in.position += value_size;
+    }
+    return true;
+}
+
+void
+clear_loaded_snapshot(state_snapshot& snapshot)
+{
+    snapshot.loaded.clear();
+}
+
+void
+write_snapshot(state_snapshot const& snapshot, std::string& out)
+{
+    out.append(snapshot_magic, sizeof(snapshot_magic));
+    write_snapshot_value(out, snapshot_format_version);
+    // The entry count is filled in at the end.
+    std::size_t const count_offset = out.size();
+    write_snapshot_value(out, std::uint32_t(0));
+
+    std::uint32_t entry_count = 0;
+    std::unordered_set<std::string> written;
+    for (snapshot_entry const* i = snapshot.entries; i; i = i->next)
+    {
+        // If there are duplicate keys, the first entry wins.
+        if (written.count(i->key))
+            continue;
+        std::size_t const entry_offset = out.size();
+        write_snapshot_value(out, i->key);
+        std::size_t const size_offset = out.size();
+        write_snapshot_value(out, std::uint32_t(0));
+        if (!i->write_value(out))
+        {
+            out.resize(entry_offset);
+            continue;
+        }
+        std::uint32_t const value_size
+            = std::uint32_t(out.size() - size_offset - sizeof(std::uint32_t));
+        std::memcpy(&out[size_offset], &value_size, sizeof(value_size));
+        written.insert(i->key);
+        ++entry_count;
+    }
+
+    // Carry over any loaded values that nothing has claimed.
+    for (auto const& loaded : snapshot.loaded)
+    {
+        if (written.count(loaded.first))
+            continue;
+        write_snapshot_value(out, loaded.first);
+        std::size_t const value_size
+            = std::size_t(loaded.second.end - loaded.second.position);
+        write_snapshot_value(out, std::uint32_t(value_size));
+        out.append(loaded.second.position, value_size);
+        ++entry_count;
+    }
+
+    std::memcpy(&out[count_offset], &entry_count, sizeof(entry_count));
+}
+
+void
+attach_snapshot_entry(
+    state_snapshot& snapshot, snapshot_entry& entry, std::string key)
+{
+    if (entry.snapshot)
+        detach_snapshot_entry(entry);
+    entry.snapshot = &snapshot;
+    entry.key = std::move(key);
+    entry.prev = nullptr;
+    entry.next = snapshot.entries;
+    if (snapshot.entries)
+        snapshot.entries->prev = &entry;
+    snapshot.entries = &entry;
+}
+
+bool
+find_snapshot_value(snapshot_entry const& entry, snapshot_reader& reader)
+{
+    if (!entry.snapshot)
+        return false;
+    auto const& loaded = entry.snapshot->loaded;
+    auto i = loaded.find(entry.key);
+    if (i == loaded.end())
+        return false;
+    reader = i->second;
+    return true;
+}
+
 } // namespace alia
 #endif
 #endif
@@ -0,0 +1,151 @@
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<std::size_t> allocation_count(0);
+
+struct registered_benchmark
+{
+    std::string name;
+    benchmark_function function;
+};
+
+std::vector<registered_benchmark>&
+get_registry()
+{
+    static std::vector<registered_benchmark> registry;
+    return registry;
+}
+
+// Run :benchmark (for as many iterations as :state allows) and return the
+// elapsed time in nanoseconds. The number of heap allocations made during the
+// run is stored in :allocations.
+double
+time_iterations(
+    registered_benchmark const& benchmark,
+    benchmark_state& state,
+    std::size_t* allocations)
+{
+    std::size_t initial_allocations = get_allocation_count();
+    auto start = std::chrono::steady_clock::now();
+    benchmark.function(state);
+    auto end = std::chrono::steady_clock::now();
+    *allocations = get_allocation_count() - initial_allocations;
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+} // namespace
+
+// Replace the global allocation functions so that allocations can be counted.
+// (The array and nothrow forms are all implemented in terms of these.)
+
+void*
+operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void
+operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void
+operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+std::size_t
+get_allocation_count()
+{
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+int
+register_benchmark(char const* name, benchmark_function function)
+{
+    get_registry().push_back({name, std::move(function)});
+    return 0;
+}
+
+void
+run_benchmarks(std::string const& filter)
+{
+    // Each benchmark should run for at least this long.
+    double const target_ns = 2e8;
+
+    std::printf(
+        "%-48s %12s %12s %12s %12s\n",
+        "benchmark",
+        "iterations",
+        "ns/iter",
+        "ns/item",
+        "allocs/iter");
+    for (auto const& benchmark : get_registry())
+    {
+        if (benchmark.name.find(filter) == std::string::npos)
+            continue;
+
+        // Keep increasing the iteration count until the run takes long enough
+        // to be meaningful.
+        std::size_t iterations = 1;
+        double elapsed_ns;
+        std::size_t allocations;
+        benchmark_state state;
+        while (true)
+        {
+            state = benchmark_state();
+            state.remaining_ = iterations;
+            elapsed_ns = time_iterations(benchmark, state, &allocations);
+            if (elapsed_ns >= target_ns || iterations >= (std::size_t(1) << 40))
+                break;
+            double scale = elapsed_ns > 0 ? target_ns / elapsed_ns : 100;
+            iterations = std::max(
+                iterations + 1,
+                std::size_t(iterations * std::min(scale * 1.2, 100.)));
+        }
+
+        double ns_per_iteration = elapsed_ns / iterations;
+        // (This includes any allocations made while setting up the
+        // benchmark, but those are amortized over all the iterations.)
+        double allocations_per_iteration = double(allocations) / iterations;
+        if (state.items_per_iteration != 0)
+        {
+            std::printf(
+                "%-48s %12zu %12.1f %12.2f %12.2f\n",
+                benchmark.name.c_str(),
+                iterations,
+                ns_per_iteration,
+                ns_per_iteration / state.items_per_iteration,
+                allocations_per_iteration);
+        }
+        else
+        {
+            std::printf(
+                "%-48s %12zu %12.1f %12s %12.2f\n",
+                benchmark.name.c_str(),
+                iterations,
+                ns_per_iteration,
+                "-",
+                allocations_per_iteration);
+        }
+        for (auto const& counter : state.counters_)
+        {
+            std::printf(
+                "    %-44s %12.2f per iteration\n",
+                counter.first.c_str(),
+                counter.second / iterations);
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef QT_FUN_BENCHMARK_HPP
+#define QT_FUN_BENCHMARK_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// This file provides a very small benchmarking harness. Each benchmark is a
+// function that repeatedly runs the code under test for as long as
+// state.keep_running() returns true. The harness picks the number of
+// iterations so that each benchmark runs for a reasonable amount of time and
+// then reports the time per iteration (and per item, if the benchmark reports
+// how many items each iteration processes), along with the number of heap
+// allocations per iteration.
+
+struct benchmark_state
+{
+    // Call this once per iteration of the benchmark loop.
+    bool
+    keep_running()
+    {
+        if (remaining_ == 0)
+            return false;
+        --remaining_;
+        return true;
+    }
+
+    // the number of items processed (e.g., data nodes visited) per iteration
+    std::size_t items_per_iteration = 0;
+
+    // Report a custom count (e.g., of Qt layout calls), given as a total over
+    // all iterations. It's reported per iteration.
+    void
+    set_counter(std::string const& name, double total)
+    {
+        for (auto& counter : counters_)
+        {
+            if (counter.first == name)
+            {
+                counter.second = total;
+                return;
+            }
+        }
+        counters_.emplace_back(name, total);
+    }
+
+ private:
+    friend void
+    run_benchmarks(std::string const& filter);
+    std::size_t remaining_ = 0;
+    std::vector<std::pair<std::string, double>> counters_;
+};
+
+typedef std::function<void(benchmark_state&)> benchmark_function;
+
+// Register a benchmark. (This is normally done via REGISTER_BENCHMARK.)
+int
+register_benchmark(char const* name, benchmark_function function);
+
+// Get the total number of heap allocations (via operator new) that have been
+// made by the program so far.
+std::size_t
+get_allocation_count();
+
+// Run all registered benchmarks whose names contain :filter.
+void
+run_benchmarks(std::string const& filter);
+
+// REGISTER_BENCHMARK(f) registers the benchmark function f under its own name.
+#define REGISTER_BENCHMARK(f)                                                  \
+    static int const f##_registration = register_benchmark(#f, f);
+
+// Prevent the compiler from optimizing away a value.
+template<class T>
+void
+do_not_optimize(T const& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif
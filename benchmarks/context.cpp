@@ -0,0 +1,55 @@
+#include "alia.hpp"
+
+#include "benchmark.hpp"
+
+using namespace alia;
+
+namespace {
+
+struct test_component
+{
+    int value = 1;
+};
+ALIA_DEFINE_COMPONENT_TYPE(generic_test_tag, test_component&)
+ALIA_DEFINE_SLOTTED_COMPONENT_TYPE(slotted_test_tag, test_component&, 0)
+
+int const lookup_count = 1000;
+
+// Retrieve a component :lookup_count times per iteration, the way widget
+// functions do.
+template<class Tag>
+void
+component_lookup(benchmark_state& state)
+{
+    context_component_storage storage;
+    test_component component;
+    auto ctx = extend_context<Tag>(
+        make_empty_component_collection(&storage), component);
+    state.items_per_iteration = lookup_count;
+    while (state.keep_running())
+    {
+        for (int i = 0; i != lookup_count; ++i)
+        {
+            // Hide the context from the optimizer so the lookup can't be
+            // hoisted out of the loop.
+            do_not_optimize(ctx);
+            do_not_optimize(get_component<Tag>(ctx).value);
+        }
+    }
+}
+
+void
+generic_component_lookup(benchmark_state& state)
+{
+    component_lookup<generic_test_tag>(state);
+}
+REGISTER_BENCHMARK(generic_component_lookup)
+
+void
+slotted_component_lookup(benchmark_state& state)
+{
+    component_lookup<slotted_test_tag>(state);
+}
+REGISTER_BENCHMARK(slotted_component_lookup)
+
+} // namespace
@@ -0,0 +1,84 @@
+#include "alia.hpp"
+
+#include "benchmark.hpp"
+
+using namespace alia;
+
+namespace {
+
+int const node_count = 1000;
+
+// This is how get_data used to check the type of each node it retrieved. It's
+// kept here to provide a baseline for the cheaper checks.
+template<class T>
+bool
+get_data_with_dynamic_cast(data_traversal& traversal, T** ptr)
+{
+    data_node* node = *traversal.next_data_ptr;
+    if (node)
+    {
+        if (!dynamic_cast<typed_data_node<T>*>(node))
+            assert(dynamic_cast<typed_data_node<T>*>(node));
+        typed_data_node<T>* typed_node = static_cast<typed_data_node<T>*>(node);
+        traversal.next_data_ptr = &node->next;
+        *ptr = &typed_node->value;
+        return false;
+    }
+    return get_data(traversal, ptr);
+}
+
+// Traverse a flat block of :node_count int nodes, retrieving each one with
+// :retrieve.
+template<class Retrieve>
+void
+traverse_flat_block(benchmark_state& state, Retrieve retrieve)
+{
+    data_graph graph;
+    auto traverse = [&]() {
+        data_traversal traversal;
+        scoped_data_traversal sdt(graph, traversal);
+        for (int i = 0; i != node_count; ++i)
+        {
+            int* value;
+            retrieve(traversal, &value);
+            do_not_optimize(*value);
+        }
+    };
+    // Build the graph first so that the loop only measures retrieval.
+    traverse();
+    state.items_per_iteration = node_count;
+    while (state.keep_running())
+        traverse();
+}
+
+void
+get_data_traversal(benchmark_state& state)
+{
+    traverse_flat_block(
+        state, [](data_traversal& traversal, int** value) {
+            get_data(traversal, value);
+        });
+}
+REGISTER_BENCHMARK(get_data_traversal)
+
+void
+get_data_traversal_with_dynamic_cast(benchmark_state& state)
+{
+    traverse_flat_block(
+        state, [](data_traversal& traversal, int** value) {
+            get_data_with_dynamic_cast(traversal, value);
+        });
+}
+REGISTER_BENCHMARK(get_data_traversal_with_dynamic_cast)
+
+void
+get_cached_data_traversal(benchmark_state& state)
+{
+    traverse_flat_block(
+        state, [](data_traversal& traversal, int** value) {
+            get_cached_data(traversal, value);
+        });
+}
+REGISTER_BENCHMARK(get_cached_data_traversal)
+
+} // namespace
@@ -0,0 +1,185 @@
+#include "alia.hpp"
+
+#include <string>
+#include <vector>
+
+#include "benchmark.hpp"
+
+using namespace alia;
+
+namespace {
+
+std::size_t const text_size = 1 << 20;
+
+// Simulate what a component does every pass with the value ID of a large,
+// unchanging value: test it against the captured ID and recapture it if it
+// changed. (It never changes here, so this just measures the testing.)
+template<class MakeId>
+void
+check_large_value_id(benchmark_state& state, MakeId make)
+{
+    std::string text(text_size, 'x');
+    captured_id captured;
+    captured.capture(make(text));
+    state.items_per_iteration = 1;
+    while (state.keep_running())
+    {
+        auto id = make(text);
+        if (!captured.matches(id))
+            captured.capture(id);
+        do_not_optimize(captured);
+    }
+}
+
+void
+large_value_id_by_reference(benchmark_state& state)
+{
+    check_large_value_id(state, [](std::string const& text) {
+        return make_id_by_reference(text);
+    });
+}
+REGISTER_BENCHMARK(large_value_id_by_reference)
+
+void
+large_value_hashed_id(benchmark_state& state)
+{
+    check_large_value_id(
+        state, [](std::string const& text) { return make_hashed_id(text); });
+}
+REGISTER_BENCHMARK(large_value_hashed_id)
+
+void
+large_value_versioned_id(benchmark_state& state)
+{
+    check_large_value_id(state, [](std::string const& text) {
+        return make_hashed_id(text, 1);
+    });
+}
+REGISTER_BENCHMARK(large_value_versioned_id)
+
+// Same, but through identify_by_hash() on a state holding the value, as a
+// controller would do it. The hash is cached along with the state's own
+// (version-based) ID, so this only hashes the value once.
+void
+large_value_identify_by_hash(benchmark_state& state)
+{
+    std::string const initial_text(text_size, 'x');
+    captured_id captured;
+    alia::system sys;
+    sys.controller = [&](context ctx) {
+        auto text = identify_by_hash(ctx, get_state(ctx, direct(initial_text)));
+        if (!captured.matches(text.value_id()))
+            captured.capture(text.value_id());
+        do_not_optimize(captured);
+    };
+    refresh_system(sys);
+    state.items_per_iteration = 1;
+    while (state.keep_running())
+        refresh_system(sys);
+}
+REGISTER_BENCHMARK(large_value_identify_by_hash)
+
+// Same, but the value changes on every pass, so the ID is recaptured.
+template<class MakeId>
+void
+capture_large_value_id(benchmark_state& state, MakeId make)
+{
+    std::string text(text_size, 'x');
+    captured_id captured;
+    state.items_per_iteration = 1;
+    std::size_t i = 0;
+    while (state.keep_running())
+    {
+        text[i++ % text_size] ^= 1;
+        auto id = make(text);
+        if (!captured.matches(id))
+            captured.capture(id);
+        do_not_optimize(captured);
+    }
+}
+
+void
+changing_value_id_by_reference(benchmark_state& state)
+{
+    capture_large_value_id(state, [](std::string const& text) {
+        return make_id_by_reference(text);
+    });
+}
+REGISTER_BENCHMARK(changing_value_id_by_reference)
+
+void
+changing_value_hashed_id(benchmark_state& state)
+{
+    capture_large_value_id(
+        state, [](std::string const& text) { return make_hashed_id(text); });
+}
+REGISTER_BENCHMARK(changing_value_hashed_id)
+
+void
+changing_value_versioned_id(benchmark_state& state)
+{
+    counter_type version = 0;
+    capture_large_value_id(state, [&](std::string const& text) {
+        return make_hashed_id(text, ++version);
+    });
+}
+REGISTER_BENCHMARK(changing_value_versioned_id)
+
+// Capture an ID whose type alternates between a simple ID and null_id, as
+// happens when a signal alternates between having and not having a value.
+void
+captured_id_type_changes(benchmark_state& state)
+{
+    captured_id captured;
+    state.items_per_iteration = 2;
+    int i = 0;
+    while (state.keep_running())
+    {
+        captured.capture(make_id(++i));
+        do_not_optimize(captured);
+        captured.capture(null_id);
+        do_not_optimize(captured);
+    }
+}
+REGISTER_BENCHMARK(captured_id_type_changes)
+
+// Capture a changing combination of referenced IDs, as happens with the
+// argument IDs of apply() and friends (and the IDs of signals that combine
+// other signals). The first capture allocates the pair itself, but after that,
+// the referenced IDs are copied into the existing pair.
+void
+captured_combined_ref_changes(benchmark_state& state)
+{
+    captured_id captured;
+    state.items_per_iteration = 1;
+    counter_type i = 0;
+    while (state.keep_running())
+    {
+        auto version_id = make_id(++i);
+        auto pointer_id = make_id(&captured);
+        captured.capture(
+            combine_ids(unit_id, ref(version_id), ref(pointer_id)));
+        do_not_optimize(captured);
+    }
+}
+REGISTER_BENCHMARK(captured_combined_ref_changes)
+
+// Copy a list of captured ID pairs (like the ones that are stored for
+// combined signal IDs).
+void
+captured_id_copies(benchmark_state& state)
+{
+    int const id_count = 100;
+    std::vector<captured_id> ids;
+    for (int i = 0; i != id_count; ++i)
+        ids.emplace_back(combine_ids(make_id(i), make_id(counter_type(i))));
+    state.items_per_iteration = id_count;
+    while (state.keep_running())
+    {
+        std::vector<captured_id> copy = ids;
+        do_not_optimize(copy);
+    }
+}
+REGISTER_BENCHMARK(captured_id_copies)
+
+} // namespace
@@ -0,0 +1,12 @@
+#define ALIA_IMPLEMENTATION
+#include "alia.hpp"
+
+#include "benchmark.hpp"
+
+int
+main(int argc, char* argv[])
+{
+    // An optional argument filters which benchmarks are run.
+    run_benchmarks(argc > 1 ? argv[1] : "");
+    return 0;
+}
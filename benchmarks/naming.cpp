@@ -0,0 +1,78 @@
+#include "alia.hpp"
+
+#include <algorithm>
+#include <random>
+
+#include "benchmark.hpp"
+
+using namespace alia;
+
+namespace {
+
+int const block_count = 10000;
+
+// Traverse :block_count named blocks, reshuffling their order on every pass,
+// so that every lookup misses the predicted block and has to go through the
+// naming map.
+void
+named_block_reordering(benchmark_state& state)
+{
+    std::vector<int> keys(block_count);
+    for (int i = 0; i != block_count; ++i)
+        keys[i] = i;
+    std::mt19937 rng(0);
+
+    data_graph graph;
+    auto traverse = [&]() {
+        data_traversal traversal;
+        scoped_data_traversal sdt(graph, traversal);
+        naming_context nc;
+        nc.begin(traversal);
+        for (int key : keys)
+        {
+            named_block nb;
+            nb.begin(traversal, nc.map(), make_id(key), manual_delete(false));
+            int* value;
+            get_data(traversal, &value);
+            do_not_optimize(*value);
+            nb.end();
+        }
+    };
+    traverse();
+    state.items_per_iteration = block_count;
+    while (state.keep_running())
+    {
+        std::shuffle(keys.begin(), keys.end(), rng);
+        traverse();
+    }
+}
+REGISTER_BENCHMARK(named_block_reordering)
+
+// Same, but the order is stable, so the predicted blocks are always right.
+void
+named_block_stable_order(benchmark_state& state)
+{
+    data_graph graph;
+    auto traverse = [&]() {
+        data_traversal traversal;
+        scoped_data_traversal sdt(graph, traversal);
+        naming_context nc;
+        nc.begin(traversal);
+        for (int key = 0; key != block_count; ++key)
+        {
+            named_block nb;
+            nb.begin(traversal, nc.map(), make_id(key), manual_delete(false));
+            int* value;
+            get_data(traversal, &value);
+            do_not_optimize(*value);
+            nb.end();
+        }
+    };
+    traverse();
+    state.items_per_iteration = block_count;
+    while (state.keep_running())
+        traverse();
+}
+REGISTER_BENCHMARK(named_block_stable_order)
+
+} // namespace
@@ -0,0 +1,517 @@
+// These benchmarks measure the Qt adaptor (along with alia) through full
+// refreshes of synthetic UIs. Besides the usual timings, they report the
+// number of Qt layout calls per refresh.
+//
+// They're built as a separate executable (with the adaptor from main.cpp and
+// the benchmark harness) since they need Qt. They run on Qt's offscreen
+// platform unless QT_QPA_PLATFORM says otherwise.
+//
+// The benchmarks with a _headless suffix run the same UI through a headless
+// backend, which maintains the UI tree without any widgets. Comparing the two
+// separates the cost of alia and the adaptor's traversal from Qt's.
+
+#define QT_FUN_NO_APP
+#include "../../main.cpp"
+
+#include <chrono>
+#include <memory>
+
+#include "../benchmark.hpp"
+
+namespace {
+
+// Run :controller through an initial refresh of a fresh Qt UI and then call
+// :step(qt_system, alia_system) once per iteration. (:step is expected to do
+// whatever is being benchmarked, including any refreshes.) If :headless is
+// set, the UI is presented through a headless backend.
+template<class Controller, class Step>
+void
+run_qt_iterations(
+    benchmark_state& state,
+    std::size_t node_count,
+    Controller controller,
+    Step step,
+    bool headless)
+{
+    // The widgets in the alia system's data graph live inside the window, so
+    // the system has to go first.
+    qt_system qt;
+    std::unique_ptr<QWidget> window;
+    std::unique_ptr<QTimer> timer;
+    std::unique_ptr<QTimer> frame_timer;
+    alia::system sys;
+    qt_headless_backend* backend = nullptr;
+    if (headless)
+    {
+        backend = new qt_headless_backend;
+        initialize(
+            qt, sys, controller, std::unique_ptr<qt_headless_backend>(backend));
+    }
+    else
+    {
+        initialize(qt, sys, controller);
+    }
+    window.reset(qt.window);
+    timer.reset(qt.external.timer);
+    frame_timer.reset(qt.external.frame_clock.timer);
+
+    qt_layout_stats& stats = get_qt_layout_stats();
+    stats = qt_layout_stats();
+    std::size_t diff_count = 0;
+    state.items_per_iteration = node_count;
+    while (state.keep_running())
+    {
+        step(qt, sys);
+        // The diffs are recorded (since that's part of the backend's cost)
+        // but not kept.
+        if (backend)
+        {
+            diff_count += backend->diffs.size();
+            backend->diffs.clear();
+        }
+    }
+    state.set_counter("layout reconciles", double(stats.reconciles));
+    state.set_counter("layout removals", double(stats.removals));
+    state.set_counter("layout insertions", double(stats.insertions));
+    if (backend)
+        state.set_counter("headless diffs", double(diff_count));
+}
+
+// Run :controller through an initial refresh of a fresh Qt UI and then
+// through one refresh per iteration, calling :mutate before each of those.
+template<class Controller, class Mutate>
+void
+run_qt_refreshes(
+    benchmark_state& state,
+    std::size_t node_count,
+    Controller controller,
+    Mutate mutate,
+    bool headless = false)
+{
+    run_qt_iterations(
+        state,
+        node_count,
+        controller,
+        [&](qt_system&, alia::system& sys) {
+            mutate();
+            refresh_system(sys);
+        },
+        headless);
+}
+
+std::size_t const label_count = 200;
+
+// N labels in a flat list, none of which change.
+void
+qt_flat_labels(benchmark_state& state)
+{
+    run_qt_refreshes(
+        state,
+        label_count,
+        [](qt_context ctx) {
+            for (std::size_t i = 0; i != label_count; ++i)
+                do_label(ctx, value(std::to_string(i)));
+        },
+        [] {});
+}
+REGISTER_BENCHMARK(qt_flat_labels)
+
+// the same labels, but with their text changing on every refresh
+void
+run_changing_labels(benchmark_state& state, bool headless)
+{
+    int counter = 0;
+    run_qt_refreshes(
+        state,
+        label_count,
+        [&](qt_context ctx) {
+            for (std::size_t i = 0; i != label_count; ++i)
+                do_label(ctx, value(std::to_string(counter + int(i))));
+        },
+        [&] { ++counter; },
+        headless);
+}
+
+void
+qt_changing_labels(benchmark_state& state)
+{
+    run_changing_labels(state, false);
+}
+REGISTER_BENCHMARK(qt_changing_labels)
+
+void
+qt_changing_labels_headless(benchmark_state& state)
+{
+    run_changing_labels(state, true);
+}
+REGISTER_BENCHMARK(qt_changing_labels_headless)
+
+std::size_t const nesting_depth = 50;
+
+void
+do_nested_columns(qt_context ctx, std::size_t depth)
+{
+    column_layout column(ctx);
+    do_label(ctx, value(std::to_string(depth)));
+    ALIA_IF(depth != 0)
+    {
+        do_nested_columns(ctx, depth - 1);
+    }
+    ALIA_END
+}
+
+// deeply nested column layouts, with the innermost label toggled on and off
+// (so every column on the path has to be updated)
+void
+qt_deep_columns(benchmark_state& state)
+{
+    bool shown = false;
+    run_qt_refreshes(
+        state,
+        nesting_depth,
+        [&](qt_context ctx) {
+            do_nested_columns(ctx, nesting_depth);
+            ALIA_IF(shown)
+            {
+                do_label(ctx, value(std::string("innermost")));
+            }
+            ALIA_END
+        },
+        [&] { shown = !shown; });
+}
+REGISTER_BENCHMARK(qt_deep_columns)
+
+// a block of labels that's toggled on and off on every refresh
+void
+qt_if_toggling(benchmark_state& state)
+{
+    bool shown = false;
+    run_qt_refreshes(
+        state,
+        label_count,
+        [&](qt_context ctx) {
+            ALIA_IF(shown)
+            {
+                for (std::size_t i = 0; i != label_count; ++i)
+                    do_label(ctx, value(std::to_string(i)));
+            }
+            ALIA_END
+        },
+        [&] { shown = !shown; });
+}
+REGISTER_BENCHMARK(qt_if_toggling)
+
+// keyed items for for_each - Each item is identified by its key, so its
+// widgets follow it around as items are inserted, removed and reordered.
+struct keyed_item
+{
+    int key;
+    std::string text;
+};
+bool
+operator==(keyed_item const& a, keyed_item const& b)
+{
+    return a.key == b.key && a.text == b.text;
+}
+bool
+operator<(keyed_item const& a, keyed_item const& b)
+{
+    return a.key < b.key || (a.key == b.key && a.text < b.text);
+}
+auto
+get_alia_id(keyed_item const& item)
+{
+    return make_id(item.key);
+}
+
+// Run a keyed for_each over labels for :label_count items, calling :mutate
+// on the items before each refresh.
+template<class Mutate>
+void
+qt_keyed_items(benchmark_state& state, Mutate mutate, bool headless = false)
+{
+    std::vector<keyed_item> items;
+    for (std::size_t i = 0; i != label_count; ++i)
+        items.push_back({int(i), "item " + std::to_string(i)});
+    counter_type version = 1;
+    run_qt_refreshes(
+        state,
+        label_count,
+        [&](qt_context ctx) {
+            for_each(
+                ctx,
+                identify_by_version(direct(items), version),
+                [](qt_context ctx, auto item) {
+                    do_label(ctx, alia_field(item, text));
+                });
+        },
+        [&] {
+            mutate(items);
+            ++version;
+        },
+        headless);
+}
+
+// Remove an item from the middle and insert it back at the front.
+void
+qt_keyed_insert_delete(benchmark_state& state)
+{
+    qt_keyed_items(state, [](std::vector<keyed_item>& items) {
+        auto middle = items.begin() + items.size() / 2;
+        keyed_item item = *middle;
+        items.erase(middle);
+        items.insert(items.begin(), item);
+    });
+}
+REGISTER_BENCHMARK(qt_keyed_insert_delete)
+
+// Reverse the items.
+void
+run_keyed_reorder(benchmark_state& state, bool headless)
+{
+    qt_keyed_items(
+        state,
+        [](std::vector<keyed_item>& items) {
+            std::reverse(items.begin(), items.end());
+        },
+        headless);
+}
+
+void
+qt_keyed_reorder(benchmark_state& state)
+{
+    run_keyed_reorder(state, false);
+}
+REGISTER_BENCHMARK(qt_keyed_reorder)
+
+void
+qt_keyed_reorder_headless(benchmark_state& state)
+{
+    run_keyed_reorder(state, true);
+}
+REGISTER_BENCHMARK(qt_keyed_reorder_headless)
+
+std::size_t const button_count = 100;
+
+// Click through N buttons (one per iteration), each of which increments a
+// counter that's shown in a label next to it. The clicks are dispatched
+// directly as alia events (as the buttons' Qt signals would), so this runs
+// the same way with or without widgets.
+void
+qt_button_clicks(benchmark_state& state, bool headless)
+{
+    std::vector<int> counts(button_count, 0);
+    std::vector<qt_button*> buttons;
+    std::size_t next_button = 0;
+    run_qt_iterations(
+        state,
+        1,
+        [&](qt_context ctx) {
+            for (std::size_t i = 0; i != button_count; ++i)
+            {
+                int& count = counts[i];
+                do_button(
+                    ctx,
+                    value(std::string("+")),
+                    lambda_action([&count]() { ++count; }));
+                do_label(ctx, as_text(ctx, direct(count)));
+            }
+        },
+        [&](qt_system& qt, alia::system& sys) {
+            if (buttons.empty())
+            {
+                for (auto* node = qt.root.children; node; node = node->next)
+                {
+                    if (auto* button = dynamic_cast<qt_button*>(node))
+                        buttons.push_back(button);
+                }
+            }
+            qt_button& button = *buttons[next_button];
+            next_button = (next_button + 1) % buttons.size();
+            click_event event;
+            dispatch_targeted_event(
+                sys, event, routable_node_id{&button, button.route});
+            if (system_needs_refresh(sys))
+                refresh_system(sys);
+        },
+        headless);
+}
+
+void
+qt_button_clicks_widgets(benchmark_state& state)
+{
+    qt_button_clicks(state, false);
+}
+REGISTER_BENCHMARK(qt_button_clicks_widgets)
+
+void
+qt_button_clicks_headless(benchmark_state& state)
+{
+    qt_button_clicks(state, true);
+}
+REGISTER_BENCHMARK(qt_button_clicks_headless)
+
+// Alternately fill and clear a keyed list of N labels. With :incremental set,
+// the cleared items (and their widgets) are destroyed after the refresh, in
+// passes of a fixed budget, as the idle handler that enable_incremental_gc()
+// sets up would do. Besides the overall time, this reports the time spent in
+// the refreshes themselves, since that's what stalls the UI.
+void
+qt_list_teardown(benchmark_state& state, bool incremental)
+{
+    std::chrono::microseconds const gc_budget(1000);
+    std::vector<keyed_item> all_items;
+    for (std::size_t i = 0; i != label_count; ++i)
+        all_items.push_back({int(i), "item " + std::to_string(i)});
+    std::vector<keyed_item> items;
+    counter_type version = 1;
+
+    qt_system qt;
+    std::unique_ptr<QWidget> window;
+    std::unique_ptr<QTimer> timer;
+    std::unique_ptr<QTimer> frame_timer;
+    alia::system sys;
+    initialize(qt, sys, [&](qt_context ctx) {
+        for_each(
+            ctx,
+            identify_by_version(direct(items), version),
+            [](qt_context ctx, auto item) {
+                do_label(ctx, alia_field(item, text));
+            });
+    });
+    window.reset(qt.window);
+    timer.reset(qt.external.timer);
+    frame_timer.reset(qt.external.frame_clock.timer);
+    sys.data.incremental_gc = incremental;
+
+    state.items_per_iteration = label_count;
+    std::chrono::steady_clock::duration refresh_time(0);
+    std::size_t gc_passes = 0;
+    while (state.keep_running())
+    {
+        if (items.empty())
+            items = all_items;
+        else
+            items.clear();
+        ++version;
+        auto start = std::chrono::steady_clock::now();
+        refresh_system(sys);
+        refresh_time += std::chrono::steady_clock::now() - start;
+        while (!sys.data.dead_named_blocks.empty())
+        {
+            collect_dead_named_blocks(sys.data, gc_budget);
+            ++gc_passes;
+        }
+    }
+    state.set_counter(
+        "refresh us",
+        std::chrono::duration<double, std::micro>(refresh_time).count());
+    state.set_counter("gc passes", double(gc_passes));
+}
+
+void
+qt_list_teardown_eager(benchmark_state& state)
+{
+    qt_list_teardown(state, false);
+}
+REGISTER_BENCHMARK(qt_list_teardown_eager)
+
+void
+qt_list_teardown_incremental(benchmark_state& state)
+{
+    qt_list_teardown(state, true);
+}
+REGISTER_BENCHMARK(qt_list_teardown_incremental)
+
+std::size_t const panel_count = 20;
+std::size_t const labels_per_panel = 10;
+
+// Build (and tear down) a UI made up of hidden panels of labels, as happens
+// at startup for a UI with lots of collapsed panels. Along with the overall
+// time, this reports the startup phases that initialize() times.
+void
+qt_hidden_panels(benchmark_state& state, bool lazy)
+{
+    state.items_per_iteration = panel_count * labels_per_panel;
+    qt_startup_timings totals;
+    while (state.keep_running())
+    {
+        qt_system qt;
+        std::unique_ptr<QWidget> window;
+        std::unique_ptr<QTimer> timer;
+        std::unique_ptr<QTimer> frame_timer;
+        alia::system sys;
+        initialize(qt, sys, [&](qt_context ctx) {
+            for (std::size_t i = 0; i != panel_count; ++i)
+            {
+                do_panel(
+                    ctx,
+                    value(false),
+                    [](qt_context ctx) {
+                        for (std::size_t j = 0; j != labels_per_panel; ++j)
+                            do_label(ctx, value(std::to_string(j)));
+                    },
+                    lazy_content(lazy));
+            }
+        });
+        window.reset(qt.window);
+        timer.reset(qt.external.timer);
+        frame_timer.reset(qt.external.frame_clock.timer);
+        totals.initial_build += qt.startup_timings.initial_build;
+        totals.layout += qt.startup_timings.layout;
+    }
+    state.set_counter("initial build us", totals.initial_build);
+    state.set_counter("layout us", totals.layout);
+}
+
+void
+qt_hidden_panels_eager(benchmark_state& state)
+{
+    qt_hidden_panels(state, false);
+}
+REGISTER_BENCHMARK(qt_hidden_panels_eager)
+
+void
+qt_hidden_panels_lazy(benchmark_state& state)
+{
+    qt_hidden_panels(state, true);
+}
+REGISTER_BENCHMARK(qt_hidden_panels_lazy)
+
+// Type into a text state that's shown in a text control and N labels.
+void
+qt_typing_burst(benchmark_state& state)
+{
+    std::string text;
+    run_qt_refreshes(
+        state,
+        label_count,
+        [&](qt_context ctx) {
+            auto value = get_state(ctx, std::string());
+            if (is_refresh_event(ctx) && read_signal(value) != text)
+                write_signal(value, text);
+            do_text_control(ctx, value);
+            for (std::size_t i = 0; i != label_count; ++i)
+                do_label(ctx, value);
+        },
+        [&] {
+            text.push_back('x');
+            if (text.size() > 80)
+                text.clear();
+        });
+}
+REGISTER_BENCHMARK(qt_typing_burst)
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+
+    // An optional argument filters which benchmarks are run.
+    run_benchmarks(argc > 1 ? argv[1] : "");
+    return 0;
+}
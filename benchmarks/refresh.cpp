@@ -0,0 +1,425 @@
+#include "alia.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark.hpp"
+
+using namespace alia;
+
+// These benchmarks run synthetic controllers through full refreshes of an
+// alia system. The "widgets" in them only do the data graph work that real
+// widgets do (retrieving their data and checking their signals for changes),
+// so they measure the cost of alia itself rather than any UI library.
+
+namespace {
+
+// Do the alia side of what a label does: get its data and check whether or
+// not its text has changed.
+template<class Signal>
+void
+do_fake_label(context ctx, Signal text)
+{
+    captured_id* id;
+    get_cached_data(ctx, &id);
+    refresh_signal_shadow(
+        *id, text, [&](auto const& value) { do_not_optimize(value); }, [] {});
+}
+
+// Run :controller through an initial refresh and then through one refresh
+// per iteration, calling :mutate before each of those.
+template<class Controller, class Mutate>
+void
+run_refreshes(
+    benchmark_state& state,
+    std::size_t node_count,
+    Controller controller,
+    Mutate mutate)
+{
+    alia::system sys;
+    sys.controller = controller;
+    refresh_system(sys);
+    state.items_per_iteration = node_count;
+    while (state.keep_running())
+    {
+        mutate();
+        refresh_system(sys);
+    }
+}
+
+std::size_t const label_count = 1000;
+
+// N labels in a flat list, none of which change.
+void
+refresh_flat_labels(benchmark_state& state)
+{
+    run_refreshes(
+        state,
+        label_count,
+        [](context ctx) {
+            for (std::size_t i = 0; i != label_count; ++i)
+                do_fake_label(ctx, value(int(i)));
+        },
+        [] {});
+}
+REGISTER_BENCHMARK(refresh_flat_labels)
+
+std::size_t const nesting_depth = 200;
+
+void
+do_nested_blocks(context ctx, std::size_t depth)
+{
+    do_fake_label(ctx, value(int(depth)));
+    ALIA_IF(depth != 0)
+    {
+        do_nested_blocks(ctx, depth - 1);
+    }
+    ALIA_END
+}
+
+// deeply nested conditional blocks, each with a label
+void
+refresh_deep_nesting(benchmark_state& state)
+{
+    run_refreshes(
+        state,
+        nesting_depth,
+        [](context ctx) { do_nested_blocks(ctx, nesting_depth); },
+        [] {});
+}
+REGISTER_BENCHMARK(refresh_deep_nesting)
+
+// a block of labels that's toggled on and off on every refresh
+void
+refresh_if_toggling(benchmark_state& state)
+{
+    bool shown = false;
+    run_refreshes(
+        state,
+        label_count,
+        [&](context ctx) {
+            ALIA_IF(shown)
+            {
+                for (std::size_t i = 0; i != label_count; ++i)
+                    do_fake_label(ctx, value(int(i)));
+            }
+            ALIA_END
+        },
+        [&] { shown = !shown; });
+}
+REGISTER_BENCHMARK(refresh_if_toggling)
+
+// keyed items for for_each - Each item is identified by its key, so its data
+// follows it around as items are inserted, removed and reordered.
+struct keyed_item
+{
+    int key;
+    std::string text;
+};
+bool
+operator==(keyed_item const& a, keyed_item const& b)
+{
+    return a.key == b.key && a.text == b.text;
+}
+bool
+operator<(keyed_item const& a, keyed_item const& b)
+{
+    return a.key < b.key || (a.key == b.key && a.text < b.text);
+}
+auto
+get_alia_id(keyed_item const& item)
+{
+    return make_id(item.key);
+}
+
+std::vector<keyed_item>
+make_keyed_items(std::size_t count)
+{
+    std::vector<keyed_item> items;
+    for (std::size_t i = 0; i != count; ++i)
+        items.push_back({int(i), "item " + std::to_string(i)});
+    return items;
+}
+
+// Run a keyed for_each over :items, calling :mutate on them before each
+// refresh.
+template<class Mutate>
+void
+refresh_keyed_items(benchmark_state& state, Mutate mutate)
+{
+    std::vector<keyed_item> items = make_keyed_items(label_count);
+    // Identify the list by a version rather than by its contents, as an
+    // application should for a list this long.
+    counter_type version = 1;
+    run_refreshes(
+        state,
+        label_count,
+        [&](context ctx) {
+            for_each(
+                ctx,
+                identify_by_version(direct(items), version),
+                [](context ctx, auto item) {
+                    do_fake_label(ctx, alia_field(item, text));
+                });
+        },
+        [&] {
+            mutate(items);
+            ++version;
+        });
+}
+
+// Remove an item from the middle and insert it back at the front.
+void
+refresh_keyed_insert_delete(benchmark_state& state)
+{
+    refresh_keyed_items(state, [](std::vector<keyed_item>& items) {
+        auto middle = items.begin() + items.size() / 2;
+        keyed_item item = *middle;
+        items.erase(middle);
+        items.insert(items.begin(), item);
+    });
+}
+REGISTER_BENCHMARK(refresh_keyed_insert_delete)
+
+// Shuffle the items.
+void
+refresh_keyed_reorder(benchmark_state& state)
+{
+    std::mt19937 rng(0);
+    refresh_keyed_items(state, [&](std::vector<keyed_item>& items) {
+        std::shuffle(items.begin(), items.end(), rng);
+    });
+}
+REGISTER_BENCHMARK(refresh_keyed_reorder)
+
+// Walk the data graph of a keyed list of N labels to account for its memory.
+void
+memory_usage_walk(benchmark_state& state)
+{
+    std::vector<keyed_item> items = make_keyed_items(label_count);
+    alia::system sys;
+    sys.controller = [&](context ctx) {
+        for_each(ctx, direct(items), [](context ctx, auto item) {
+            do_fake_label(ctx, alia_field(item, text));
+        });
+    };
+    refresh_system(sys);
+    state.items_per_iteration = label_count;
+    while (state.keep_running())
+        do_not_optimize(get_total_bytes(get_memory_usage(sys.data)));
+}
+REGISTER_BENCHMARK(memory_usage_walk)
+
+// Alternately fill and clear a keyed list of N labels. With :incremental set,
+// the named blocks for the cleared items are destroyed after the refresh, by
+// collecting them in passes of :gc_budget (as an idle handler would).
+// Besides the overall time, this reports the time spent in the refreshes
+// themselves, since that's what stalls the UI.
+void
+refresh_list_teardown(benchmark_state& state, bool incremental)
+{
+    std::chrono::microseconds const gc_budget(100);
+    std::vector<keyed_item> const all_items = make_keyed_items(label_count);
+    std::vector<keyed_item> items;
+    counter_type version = 1;
+    alia::system sys;
+    sys.data.incremental_gc = incremental;
+    sys.controller = [&](context ctx) {
+        for_each(
+            ctx,
+            identify_by_version(direct(items), version),
+            [](context ctx, auto item) {
+                do_fake_label(ctx, alia_field(item, text));
+            });
+    };
+    refresh_system(sys);
+    state.items_per_iteration = label_count;
+    std::chrono::steady_clock::duration refresh_time(0);
+    std::size_t gc_passes = 0;
+    while (state.keep_running())
+    {
+        if (items.empty())
+            items = all_items;
+        else
+            items.clear();
+        ++version;
+        auto start = std::chrono::steady_clock::now();
+        refresh_system(sys);
+        refresh_time += std::chrono::steady_clock::now() - start;
+        while (!sys.data.dead_named_blocks.empty())
+        {
+            collect_dead_named_blocks(sys.data, gc_budget);
+            ++gc_passes;
+        }
+    }
+    state.set_counter(
+        "refresh us",
+        std::chrono::duration<double, std::micro>(refresh_time).count());
+    state.set_counter("gc passes", double(gc_passes));
+}
+
+void
+refresh_list_teardown_eager(benchmark_state& state)
+{
+    refresh_list_teardown(state, false);
+}
+REGISTER_BENCHMARK(refresh_list_teardown_eager)
+
+void
+refresh_list_teardown_incremental(benchmark_state& state)
+{
+    refresh_list_teardown(state, true);
+}
+REGISTER_BENCHMARK(refresh_list_teardown_incremental)
+
+// Type into a text state that N labels display (as happens when a text
+// control's value is shown around the UI).
+void
+refresh_typing_burst(benchmark_state& state)
+{
+    std::string text;
+    run_refreshes(
+        state,
+        label_count,
+        [&](context ctx) {
+            auto value = get_state(ctx, std::string());
+            if (is_refresh_event(ctx) && read_signal(value) != text)
+                write_signal(value, text);
+            for (std::size_t i = 0; i != label_count; ++i)
+                do_fake_label(ctx, value);
+        },
+        [&] {
+            text.push_back('x');
+            if (text.size() > 80)
+                text.clear();
+        });
+}
+REGISTER_BENCHMARK(refresh_typing_burst)
+
+// Bind a grid of N numbers to text (as a table of numeric text controls
+// would). With :changing set, every number changes on every refresh, so this
+// measures the numeric formatting itself. Otherwise, the list is still
+// reidentified on every refresh, but the values (and so their text) are
+// unchanged.
+void
+refresh_numeric_text_grid(benchmark_state& state, bool changing)
+{
+    std::vector<double> numbers;
+    for (std::size_t i = 0; i != label_count; ++i)
+        numbers.push_back(double(i) * 0.25);
+    counter_type version = 1;
+    run_refreshes(
+        state,
+        label_count,
+        [&](context ctx) {
+            for_each(
+                ctx,
+                identify_by_version(direct(numbers), version),
+                [](context ctx, auto number) {
+                    do_fake_label(ctx, as_bidirectional_text(ctx, number));
+                });
+        },
+        [&] {
+            if (changing)
+            {
+                for (double& n : numbers)
+                    n += 1;
+            }
+            ++version;
+        });
+}
+
+void
+refresh_numeric_text_changing(benchmark_state& state)
+{
+    refresh_numeric_text_grid(state, true);
+}
+REGISTER_BENCHMARK(refresh_numeric_text_changing)
+
+void
+refresh_numeric_text_unchanged(benchmark_state& state)
+{
+    refresh_numeric_text_grid(state, false);
+}
+REGISTER_BENCHMARK(refresh_numeric_text_unchanged)
+
+// Map N numbers to flags with parallel_transform (as a filter's predicate
+// would), changing a tenth of the numbers before each refresh. The mapped
+// flags are packed into a std::vector<bool>, so this also checks them and
+// reports any that are wrong.
+void
+refresh_parallel_predicate(benchmark_state& state)
+{
+    std::vector<int> numbers;
+    for (std::size_t i = 0; i != label_count; ++i)
+        numbers.push_back(int(i));
+    counter_type version = 1;
+    std::size_t next_change = 0;
+    std::size_t wrong_flags = 0;
+    run_refreshes(
+        state,
+        label_count,
+        [&](context ctx) {
+            auto flags = parallel_transform(
+                ctx,
+                identify_by_version(direct(numbers), version),
+                [](int n) { return n % 3 == 0; });
+            if (is_refresh_event(ctx) && signal_has_value(flags))
+            {
+                auto const& values = read_signal(flags);
+                for (std::size_t i = 0; i != numbers.size(); ++i)
+                {
+                    if (values[i] != (numbers[i] % 3 == 0))
+                        ++wrong_flags;
+                }
+            }
+        },
+        [&] {
+            for (std::size_t i = 0; i != label_count / 10; ++i)
+            {
+                ++numbers[next_change];
+                next_change = (next_change + 1) % label_count;
+            }
+            ++version;
+        });
+    state.set_counter("wrong flags", double(wrong_flags));
+}
+REGISTER_BENCHMARK(refresh_parallel_predicate)
+
+std::size_t const region_count = 20;
+
+// N labels split among frame regions, of which only the first is animating,
+// refreshed by animation frames - The other regions should be skipped, so
+// this also reports how many label refreshes each frame actually does.
+void
+refresh_animation_frames(benchmark_state& state)
+{
+    std::size_t labels_refreshed = 0;
+    alia::system sys;
+    sys.controller = [&](context ctx) {
+        for (std::size_t i = 0; i != region_count; ++i)
+        {
+            invoke_frame_region(ctx, [&](context ctx) {
+                if (i == 0 && is_refresh_event(ctx))
+                    get_raw_animation_tick_count(ctx);
+                for (std::size_t j = 0; j != label_count / region_count; ++j)
+                {
+                    do_fake_label(ctx, value(int(j)));
+                    ++labels_refreshed;
+                }
+            });
+        }
+    };
+    refresh_system(sys);
+    labels_refreshed = 0;
+    state.items_per_iteration = label_count;
+    while (state.keep_running())
+        refresh_animation_frame(sys);
+    state.set_counter("labels refreshed", double(labels_refreshed));
+}
+REGISTER_BENCHMARK(refresh_animation_frames)
+
+} // namespace
@@ -1,13 +1,32 @@
 #include <QApplication>
+#include <QBoxLayout>
+#include <QEvent>
+#include <QFile>
 #include <QFrame>
 #include <QGridLayout>
+#include <QGuiApplication>
 #include <QLabel>
 #include <QLayout>
 #include <QMessageBox>
+#include <QMetaObject>
 #include <QPushButton>
+#include <QScreen>
+#include <QScrollArea>
+#include <QScrollBar>
 #include <QTextEdit>
+#include <QTimer>
 #include <QWidget>
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
 #define ALIA_IMPLEMENTATION
 #include "alia.hpp"
 
@@ -19,58 +38,492 @@ struct qt_layout_container;
 
 struct qt_layout_node
 {
+    // Update the Qt objects associated with this node so that they live
+    // inside :parent. (For containers, this also brings the container's own
+    // layout up-to-date with its children.)
+    virtual void
+    update(alia::system* system, QWidget* parent)
+        = 0;
+
+    // Get the Qt object (widget or layout) that represents this node within
+    // its parent's layout.
+    virtual QObject*
+    qt_object()
+        = 0;
+
+    // Insert this node's Qt object into :layout at position :index.
     virtual void
-    update(alia::system* system, QWidget* parent, QLayout* layout)
+    insert_into(QBoxLayout* layout, int index)
         = 0;
 
-    qt_layout_node* next;
-    qt_layout_container* parent;
+    // If this node is a container, get it as one.
+    virtual qt_layout_container*
+    as_container()
+    {
+        return nullptr;
+    }
+
+    qt_layout_node* next = nullptr;
+    qt_layout_container* parent = nullptr;
+
+    // the serial number that identifies this node to a headless backend (or 0
+    // if it hasn't been assigned one) - See qt_headless_backend.
+    std::size_t headless_id = 0;
 };
 
 struct qt_layout_container : qt_layout_node
 {
-    qt_layout_node* children;
+    qt_layout_node* children = nullptr;
 
     virtual void
     record_change();
 
-    qt_layout_container* parent;
+    qt_layout_container*
+    as_container()
+    {
+        return this;
+    }
+
+    qt_layout_container* parent = nullptr;
+
+    bool dirty = false;
+
+    // the IDs of the children as a headless backend last recorded them
+    std::vector<std::size_t> headless_children;
+
+    // LAZY CONTENT - If :lazy is set, the container's content isn't traversed
+    // (so none of its widgets are created) until the container is first
+    // shown. If :release_delay is also nonzero, the content is released again
+    // once the container has been hidden for that many milliseconds.
+    // (This only applies to containers that can be hidden. See do_panel.)
+    bool lazy = false;
+    millisecond_count release_delay = 0;
+
+    // Is the content currently instantiated? (This is only updated on
+    // refreshes, so other events always see what the last refresh did.)
+    bool content_active = false;
+
+    // If the content is waiting to be released, this is when the container
+    // was hidden, and the timer triggers the refresh that will release it.
+    bool releasing = false;
+    millisecond_count hidden_since = 0;
+    std::unique_ptr<QTimer> release_timer;
+};
+
+// qt_root_container is the container at the root of the UI tree. Its children
+// are laid out directly in the top-level window's layout.
+struct qt_root_container : qt_layout_container
+{
+    QBoxLayout* layout = nullptr;
+
+    void
+    update(alia::system* system, QWidget* parent);
+
+    QObject*
+    qt_object()
+    {
+        return layout;
+    }
+
+    void
+    insert_into(QBoxLayout*, int)
+    {
+        // The root is never inserted into another layout.
+    }
+};
+
+// qt_layout_backend is what the UI tree is presented through. It decides what
+// it means to bring the tree up-to-date and whether or not the nodes are backed
+// by actual Qt widgets.
+struct qt_layout_backend
+{
+    virtual ~qt_layout_backend()
+    {
+    }
+
+    // Do the nodes create (and maintain) Qt widgets? If not, they only keep
+    // their place in the UI tree and report changes in their content to the
+    // backend.
+    virtual bool
+    has_widgets() const
+        = 0;
+
+    // Bring the presentation of the tree under :root up-to-date. (This is
+    // only called when something within the tree has changed.)
+    virtual void
+    update(alia::system* system, qt_root_container& root)
+        = 0;
+
+    // Record that the content of :node (e.g., a label's text) has changed.
+    // (This is only called for nodes without widgets.)
+    virtual void
+    record_content_change(qt_layout_node&)
+    {
+    }
+};
+
+// qt_widget_backend presents the UI tree through Qt widgets inside :window.
+// Updating the tree updates the nodes' widgets and layouts.
+struct qt_widget_backend : qt_layout_backend
+{
+    QWidget* window = nullptr;
+
+    bool
+    has_widgets() const
+    {
+        return true;
+    }
+
+    void
+    update(alia::system* system, qt_root_container& root)
+    {
+        root.update(system, window);
+    }
+};
+
+// qt_headless_diff is a single change in the UI tree, as recorded by a
+// headless backend. Nodes are identified by their headless IDs.
+struct qt_headless_diff
+{
+    enum kind_type
+    {
+        // :node was removed from position :index in :container.
+        REMOVAL,
+        // :node was inserted at position :index in :container.
+        INSERTION,
+        // The content of :node changed. (:container and :index are unused.)
+        CONTENT_CHANGE
+    };
+    kind_type kind;
+    std::size_t container;
+    std::size_t node;
+    int index;
+};
+
+// qt_headless_backend presents the UI tree without creating any Qt widgets
+// (or layouts). Instead, it records how the tree changes, which makes it
+// possible to drive controllers at scale (e.g., in CI) and to measure the cost
+// of the traversals themselves, apart from Qt's.
+//
+// Nodes are assigned serial IDs when the backend first sees them. Each
+// container keeps the IDs of its children from the last update, and updating
+// the tree reconciles those against the current children (just as the widget
+// backend reconciles Qt layouts), recording the differences in :diffs.
+struct qt_headless_backend : qt_layout_backend
+{
+    // If this is cleared, the differences are only counted (in
+    // qt_layout_stats and :content_changes), not recorded.
+    bool record_diffs = true;
+
+    std::vector<qt_headless_diff> diffs;
+
+    // the total number of content changes
+    std::size_t content_changes = 0;
+
+    // the last ID that was assigned
+    std::size_t last_id = 0;
 
-    bool dirty;
+    bool
+    has_widgets() const
+    {
+        return false;
+    }
+
+    void
+    update(alia::system* system, qt_root_container& root);
+
+    void
+    record_content_change(qt_layout_node& node);
+};
+
+// qt_widget_pool holds onto detached Qt widgets when the nodes that own them
+// go away, so that they can be reused by later nodes that need the same type
+// of widget (e.g., when a conditional block is toggled back on).
+struct qt_widget_pool : noncopyable
+{
+    ~qt_widget_pool();
+
+    // the maximum number of idle widgets to keep for each widget type -
+    // Widgets that are released while their type is at the limit are deleted.
+    size_t max_idle_per_type = 32;
+
+    // idle widgets, by type
+    std::unordered_map<std::type_index, std::vector<QWidget*>> idle;
+
+    // statistics
+    size_t hits = 0; // widgets that were reused from the pool
+    size_t misses = 0; // widgets that had to be created
+    size_t discards = 0; // widgets that were deleted because of the limit
+};
+
+// Take an idle widget of the given type out of :pool, reparenting it to
+// :parent. If there's none available, this returns nullptr.
+QWidget*
+take_pooled_widget(
+    qt_widget_pool& pool, std::type_index type, QWidget* parent);
+
+// Return a widget of the given type to :pool. The widget is detached from its
+// parent and hidden (or deleted if the pool is full).
+void
+return_pooled_widget(
+    qt_widget_pool& pool, std::type_index type, QWidget* widget);
+
+// pooled_widget<Widget> owns a widget that's obtained from (and returned to)
+// a qt_widget_pool.
+template<class Widget>
+struct pooled_widget : noncopyable
+{
+    ~pooled_widget()
+    {
+        reset();
+    }
+
+    // Get a widget from :pool (or create one) and place it under :parent.
+    void
+    acquire(std::shared_ptr<qt_widget_pool> const& pool, QWidget* parent)
+    {
+        reset();
+        pool_ = pool;
+        QWidget* widget = take_pooled_widget(*pool_, typeid(Widget), parent);
+        object_ = widget ? static_cast<Widget*>(widget) : new Widget(parent);
+    }
+
+    // Record a signal connection that was made on behalf of the owner. These
+    // are disconnected before the widget goes back into the pool.
+    void
+    track(QMetaObject::Connection connection)
+    {
+        connections_.push_back(connection);
+    }
+
+    // Give the widget back to the pool.
+    void
+    reset()
+    {
+        if (object_)
+        {
+            for (auto const& connection : connections_)
+                QObject::disconnect(connection);
+            connections_.clear();
+            return_pooled_widget(*pool_, typeid(Widget), object_);
+            object_ = nullptr;
+        }
+    }
+
+    Widget*
+    get() const
+    {
+        return object_;
+    }
+    Widget*
+    operator->() const
+    {
+        return object_;
+    }
+    explicit operator bool() const
+    {
+        return object_ != nullptr;
+    }
+
+ private:
+    Widget* object_ = nullptr;
+    // This is shared because the pool's qt_system may be destroyed before
+    // the data graph that holds the widgets' owners.
+    std::shared_ptr<qt_widget_pool> pool_;
+    std::vector<QMetaObject::Connection> connections_;
 };
 
+// Estimate the memory held by a pooled widget (for alia's memory accounting).
+// Qt keeps most of a widget's state in private data whose size isn't exposed,
+// so this is only a lower bound.
+template<class Widget>
+std::size_t
+get_alia_heap_size(pooled_widget<Widget> const& widget)
+{
+    return widget ? sizeof(Widget) : 0;
+}
+
 struct qt_traversal
 {
+    // the pool that new widgets should be obtained from
+    std::shared_ptr<qt_widget_pool> widget_pool;
+
+    // the backend that the UI tree is presented through
+    qt_layout_backend* backend = nullptr;
+
     QWidget* active_parent = nullptr;
     qt_layout_container* active_container = nullptr;
     // a pointer to the pointer that should store the next item that's added
     qt_layout_node** next_ptr = nullptr;
 };
-ALIA_DEFINE_COMPONENT_TYPE(qt_traversal_tag, qt_traversal&)
+ALIA_DEFINE_SLOTTED_COMPONENT_TYPE(qt_traversal_tag, qt_traversal&, 0)
 
 typedef alia::add_component_type_t<alia::context, qt_traversal_tag> qt_context;
 
 typedef alia::remove_component_type_t<qt_context, data_traversal_tag>
     dataless_qt_context;
 
+// qt_frame_clock paces animation. While anything is animating, it ticks once
+// per display frame, and each tick delivers a single refresh that covers all
+// the animation requests made since the last one. It stops ticking as soon as
+// a frame goes by without any requests.
+//
+// The refreshes that it drives see the time of their frame (snapped to the
+// frame grid) as alia's tick count, so animations advance in even steps
+// rather than with the jitter of the timer. The grid is kept in fractional
+// milliseconds, so it doesn't drift against the display's actual frames.
+//
+// Frames are animation frame refreshes (see refresh_animation_frame), so
+// unless something else has also called for a refresh, the frame regions
+// (do_frame_region) that are clean are skipped.
+struct qt_frame_clock
+{
+    // the single-shot timer that's aimed at the next frame while animation is
+    // in progress
+    QTimer* timer = nullptr;
+
+    // the time between frames, in milliseconds - This is set from the
+    // primary screen's refresh rate when the clock is initialized.
+    double frame_interval = 1000.0 / 60;
+
+    // the time of the current frame and whether or not its refresh is in
+    // progress
+    millisecond_count frame_time = 0;
+    bool in_frame = false;
+
+    // the number of frames that the clock has delivered
+    std::size_t frame_count = 0;
+};
+
+// qt_external_interface connects alia's refresh scheduling to the Qt event
+// loop. Refresh requests are coalesced into a single refresh that's performed
+// the next time Qt gets around to processing events, and animation refreshes
+// are driven by a frame clock.
+struct qt_external_interface : alia::external_interface
+{
+    alia::system* system = nullptr;
+
+    // the single-shot timer that drives pending refreshes
+    QTimer* timer = nullptr;
+
+    qt_frame_clock frame_clock;
+
+    // the last tick count given to alia (which keeps the count monotonic)
+    mutable millisecond_count last_tick = 0;
+
+    void
+    request_animation_refresh();
+
+    bool
+    schedule_refresh();
+
+    void
+    schedule_refresh_from_any_thread();
+
+    millisecond_count
+    get_tick_count() const;
+};
+
+void
+initialize(qt_external_interface& external, alia::system& system);
+
+// qt_startup_timings records how long each phase of starting up the UI took,
+// in microseconds.
+struct qt_startup_timings
+{
+    // creating the window and hooking up the systems
+    double setup = 0;
+    // the initial refresh, which builds the UI tree (with the window's
+    // updates suspended)
+    double initial_build = 0;
+    // any follow-up refresh that the initial one called for (also with the
+    // window's updates suspended)
+    double follow_up_refresh = 0;
+    // activating the window's layout once the tree is built
+    double layout = 0;
+    // showing the window (which is up to the application to record)
+    double show = 0;
+};
+
 struct qt_system
 {
     alia::system* system;
 
+    // the interface that lets alia schedule refreshes through Qt
+    qt_external_interface external;
+
     std::function<void(qt_context)> controller;
 
     // the root of the application's UI tree
-    qt_layout_node* root;
+    qt_root_container root;
+
+    // the pool of widgets that are currently unused
+    std::shared_ptr<qt_widget_pool> widget_pool
+        = std::make_shared<qt_widget_pool>();
+
+    // the backend that the UI tree is presented through
+    std::unique_ptr<qt_layout_backend> backend;
 
     // the top-level window and layout for the UI - The entire application's UI
-    // tree lives inside this.
-    QWidget* window;
-    QVBoxLayout* layout;
+    // tree lives inside this. (These are null if the backend has no widgets.)
+    QWidget* window = nullptr;
+    QVBoxLayout* layout = nullptr;
+
+    // If incremental GC is enabled (see enable_incremental_gc()), this timer
+    // destroys the parts of the UI that have disappeared whenever Qt is idle,
+    // spending up to :gc_budget on each pass.
+    QTimer* gc_timer = nullptr;
+    std::chrono::microseconds gc_budget{0};
+
+    qt_startup_timings startup_timings;
 
     void
     operator()(alia::context ctx);
 };
 
+qt_widget_pool::~qt_widget_pool()
+{
+    for (auto& widgets : idle)
+    {
+        for (QWidget* widget : widgets.second)
+            delete widget;
+    }
+}
+
+QWidget*
+take_pooled_widget(
+    qt_widget_pool& pool, std::type_index type, QWidget* parent)
+{
+    auto widgets = pool.idle.find(type);
+    if (widgets == pool.idle.end() || widgets->second.empty())
+    {
+        ++pool.misses;
+        return nullptr;
+    }
+    ++pool.hits;
+    QWidget* widget = widgets->second.back();
+    widgets->second.pop_back();
+    widget->setParent(parent);
+    return widget;
+}
+
+void
+return_pooled_widget(
+    qt_widget_pool& pool, std::type_index type, QWidget* widget)
+{
+    auto& widgets = pool.idle[type];
+    if (widgets.size() >= pool.max_idle_per_type)
+    {
+        ++pool.discards;
+        delete widget;
+        return;
+    }
+    // Detaching the widget also takes it out of whatever layout it's in (and
+    // hides it).
+    widget->setParent(nullptr);
+    widgets.push_back(widget);
+}
+
 void
 record_layout_change(qt_traversal& traversal)
 {
@@ -163,134 +616,697 @@ scoped_layout_container::end()
     }
 }
 
-struct qt_label : qt_layout_node
+// Get the Qt object that a layout item represents.
+static QObject*
+get_item_object(QLayoutItem* item)
 {
-    std::shared_ptr<QLabel> object;
-    captured_id text_id;
+    if (QWidget* widget = item->widget())
+        return widget;
+    return item->layout();
+}
 
-    void
-    update(alia::system* system, QWidget* parent, QLayout* layout)
+// Show or hide the widgets that a layout item represents. (For layouts, that's
+// all the widgets inside them.)
+static void
+set_item_visibility(QLayoutItem* item, bool visible)
+{
+    if (QWidget* widget = item->widget())
     {
-        if (object->parent() != parent)
-            object->setParent(parent);
-        layout->addWidget(object.get());
+        widget->setVisible(visible);
     }
-};
+    else if (QLayout* layout = item->layout())
+    {
+        for (int i = 0; i != layout->count(); ++i)
+            set_item_visibility(layout->itemAt(i), visible);
+    }
+}
 
+// Remove the item at :index from :layout.
 static void
-do_label(qt_context ctx, readable<string> text)
+remove_layout_item(QLayout* layout, int index)
 {
-    auto& label = get_cached_data<qt_label>(ctx);
-
-    on_refresh(ctx, [&](auto ctx) {
-        auto& system = get_component<system_tag>(ctx);
-
-        if (!label.object)
-        {
-            auto& traversal = get_component<qt_traversal_tag>(ctx);
-            auto* parent = traversal.active_parent;
-            label.object.reset(new QLabel(parent));
-            if (parent->isVisible())
-                label.object->show();
-        }
-
-        add_layout_node(ctx, &label);
-
-        refresh_signal_shadow(
-            label.text_id,
-            text,
-            [&](auto text) { label.object->setText(text.c_str()); },
-            [&]() { label.object->setText(""); });
-    });
+    QLayoutItem* item = layout->takeAt(index);
+    // Layouts are owned by their nodes, but they have to be unparented before
+    // they can be inserted into a layout again. Other items (e.g., the
+    // wrappers that Qt creates for widgets) belong to us now.
+    if (QLayout* child = item->layout())
+        child->setParent(nullptr);
+    else
+        delete item;
 }
 
-struct click_event : targeted_event
+// qt_layout_stats counts the calls that are made to keep Qt layouts in sync
+// with the UI tree. (This is only for monitoring/benchmarking purposes.)
+struct qt_layout_stats
 {
+    // the number of times a container's layout has been reconciled
+    size_t reconciles = 0;
+    // the number of items that have been removed from/inserted into layouts
+    size_t removals = 0;
+    size_t insertions = 0;
 };
 
-struct qt_button : qt_layout_node, node_identity
+qt_layout_stats&
+get_qt_layout_stats()
 {
-    std::unique_ptr<QPushButton> object;
-    captured_id text_id;
-    routing_region_ptr route;
+    static qt_layout_stats stats;
+    return stats;
+}
 
-    void
-    update(alia::system* system, QWidget* parent, QLayout* layout)
+// Count a call to qt_layout_node::update() in the system's profiler (if it has
+// one).
+static void
+record_layout_update(alia::system* system)
+{
+    if (system && system->profiler)
+        ++system->profiler->totals.layout_updates;
+}
+
+// Given the old position of each item in a new list in :sources (or -1 for
+// items that are new), find the longest run of items that are already in the
+// correct relative order. Those are the items that can stay where they are,
+// and they're flagged in the returned vector.
+static std::vector<bool>
+find_staying_items(std::vector<int> const& sources)
+{
+    // :tails[k] is the position in the new list where the best subsequence of
+    // length k + 1 found so far ends, and :predecessors links each position to
+    // the one that precedes it in its subsequence.
+    int const count = int(sources.size());
+    std::vector<int> tails;
+    std::vector<int> predecessors(count, -1);
+    for (int i = 0; i != count; ++i)
     {
-        if (object->parent() != parent)
-            object->setParent(parent);
-        layout->addWidget(object.get());
+        if (sources[i] < 0)
+            continue;
+        auto slot = std::lower_bound(
+            tails.begin(), tails.end(), sources[i], [&](int j, int source) {
+                return sources[j] < source;
+            });
+        if (slot != tails.begin())
+            predecessors[i] = *(slot - 1);
+        if (slot == tails.end())
+            tails.push_back(i);
+        else
+            *slot = i;
     }
-};
+    std::vector<bool> staying(count, false);
+    for (int i = tails.empty() ? -1 : tails.back(); i >= 0;
+         i = predecessors[i])
+    {
+        staying[i] = true;
+    }
+    return staying;
+}
 
+// Reconcile the contents of :layout with the list of nodes starting at
+// :children.
+//
+// Rather than clearing the layout and adding everything back, this leaves the
+// longest run of items that are already in the correct relative order where
+// they are and only removes/inserts the rest, so a single insertion or removal
+// costs a single Qt call.
+//
+// Note that this works from what's actually in the Qt layout rather than what
+// we last put there. Widgets that have been destroyed since the last update
+// have already removed themselves. Items that leave the layout without being
+// destroyed (because they're moving elsewhere or because their destruction
+// has been deferred by incremental GC) are hidden until they're inserted
+// again.
 static void
-do_button(qt_context ctx, readable<string> text, action<> on_click)
+reconcile_layout(QBoxLayout* layout, qt_layout_node* children)
 {
-    auto& button = get_cached_data<qt_button>(ctx);
-
-    on_refresh(ctx, [&](auto ctx) {
-        auto& system = get_component<system_tag>(ctx);
-
-        button.route = get_active_routing_region(ctx);
+    qt_layout_stats& stats = get_qt_layout_stats();
+    ++stats.reconciles;
+
+    std::vector<qt_layout_node*> nodes;
+    for (auto* node = children; node; node = node->next)
+        nodes.push_back(node);
+
+    int const old_count = layout->count();
+    std::unordered_map<QObject*, int> old_indices;
+    old_indices.reserve(old_count);
+    for (int i = 0; i != old_count; ++i)
+        old_indices[get_item_object(layout->itemAt(i))] = i;
+
+    // For each node, get the index of its object within the old layout (or -1
+    // if it's not there).
+    int const new_count = int(nodes.size());
+    std::vector<int> sources(new_count, -1);
+    for (int i = 0; i != new_count; ++i)
+    {
+        auto old = old_indices.find(nodes[i]->qt_object());
+        if (old != old_indices.end())
+            sources[i] = old->second;
+    }
 
-        if (!button.object)
+    std::vector<bool> const staying = find_staying_items(sources);
+    std::vector<bool> old_item_staying(old_count, false);
+    std::vector<bool> old_item_present(old_count, false);
+    for (int i = 0; i != new_count; ++i)
+    {
+        if (sources[i] >= 0)
         {
-            auto& traversal = get_component<qt_traversal_tag>(ctx);
-            auto* parent = traversal.active_parent;
-            button.object.reset(new QPushButton(parent));
-            if (parent->isVisible())
-                button.object->show();
-            QObject::connect(
-                button.object.get(),
-                &QPushButton::clicked,
-                // The Qt object is technically owned within both of these, so
-                // I'm pretty sure it's safe to reference both.
-                [&system, &button]() {
-                    click_event event;
-                    dispatch_targeted_event(
-                        system, event, routable_node_id{&button, button.route});
-                });
+            old_item_present[sources[i]] = true;
+            if (staying[i])
+                old_item_staying[sources[i]] = true;
         }
+    }
 
-        add_layout_node(ctx, &button);
-
-        refresh_signal_shadow(
-            button.text_id,
-            text,
-            [&](auto text) { button.object->setText(text.c_str()); },
-            [&]() { button.object->setText(""); });
-    });
+    // Remove everything that isn't staying. (Going backwards keeps the
+    // indices valid.)
+    for (int i = old_count - 1; i >= 0; --i)
+    {
+        if (!old_item_staying[i])
+        {
+            if (!old_item_present[i])
+                set_item_visibility(layout->itemAt(i), false);
+            remove_layout_item(layout, i);
+            ++stats.removals;
+        }
+    }
 
-    on_targeted_event<click_event>(ctx, &button, [&](auto ctx, auto& e) {
-        if (action_is_ready(on_click))
+    // Insert everything else at its final position. Since the items that
+    // stayed are already in the right relative order, by the time we reach
+    // position i, everything before it is in place.
+    for (int i = 0; i != new_count; ++i)
+    {
+        if (!staying[i])
         {
-            perform_action(on_click);
+            nodes[i]->insert_into(layout, i);
+            if (sources[i] < 0)
+                set_item_visibility(layout->itemAt(i), true);
+            ++stats.insertions;
         }
-    });
+    }
 }
 
-struct value_update_event : targeted_event
-{
-    string value;
-};
-
-struct qt_text_control : qt_layout_node, node_identity
+void
+qt_root_container::update(alia::system* system, QWidget* parent)
 {
-    std::shared_ptr<QTextEdit> object;
-    captured_id text_id;
-    routing_region_ptr route;
-
-    void
-    update(alia::system* system, QWidget* parent, QLayout* layout)
+    record_layout_update(system);
+    if (this->dirty)
     {
-        if (object->parent() != parent)
-            object->setParent(parent);
-        layout->addWidget(object.get());
+        for (auto* node = children; node; node = node->next)
+            node->update(system, parent);
+        reconcile_layout(layout, children);
+        this->dirty = false;
     }
-};
+}
 
+// Get the headless ID of :node, assigning it one if necessary.
+static std::size_t
+get_headless_id(qt_headless_backend& backend, qt_layout_node& node)
+{
+    if (node.headless_id == 0)
+        node.headless_id = ++backend.last_id;
+    return node.headless_id;
+}
+
+static void
+record_headless_diff(
+    qt_headless_backend& backend,
+    qt_headless_diff::kind_type kind,
+    std::size_t container,
+    std::size_t node,
+    int index)
+{
+    if (backend.record_diffs)
+        backend.diffs.push_back(qt_headless_diff{kind, container, node, index});
+}
+
+// This is the headless counterpart of reconcile_layout. It reconciles the
+// children that :container last recorded with its current ones, recording
+// the removals and insertions that that takes.
+static void
+reconcile_headless_children(
+    qt_headless_backend& backend, qt_layout_container& container)
+{
+    qt_layout_stats& stats = get_qt_layout_stats();
+    ++stats.reconciles;
+
+    std::size_t const container_id = get_headless_id(backend, container);
+
+    std::vector<std::size_t> new_ids;
+    for (auto* node = container.children; node; node = node->next)
+        new_ids.push_back(get_headless_id(backend, *node));
+
+    std::vector<std::size_t> const& old_ids = container.headless_children;
+    int const old_count = int(old_ids.size());
+    std::unordered_map<std::size_t, int> old_indices;
+    old_indices.reserve(old_count);
+    for (int i = 0; i != old_count; ++i)
+        old_indices[old_ids[i]] = i;
+
+    int const new_count = int(new_ids.size());
+    std::vector<int> sources(new_count, -1);
+    for (int i = 0; i != new_count; ++i)
+    {
+        auto old = old_indices.find(new_ids[i]);
+        if (old != old_indices.end())
+            sources[i] = old->second;
+    }
+
+    std::vector<bool> const staying = find_staying_items(sources);
+    std::vector<bool> old_item_staying(old_count, false);
+    for (int i = 0; i != new_count; ++i)
+    {
+        if (staying[i])
+            old_item_staying[sources[i]] = true;
+    }
+
+    // The indices are recorded as they would be for a Qt layout, so the diffs
+    // can be replayed in order.
+    for (int i = old_count - 1; i >= 0; --i)
+    {
+        if (!old_item_staying[i])
+        {
+            record_headless_diff(
+                backend,
+                qt_headless_diff::REMOVAL,
+                container_id,
+                old_ids[i],
+                i);
+            ++stats.removals;
+        }
+    }
+    for (int i = 0; i != new_count; ++i)
+    {
+        if (!staying[i])
+        {
+            record_headless_diff(
+                backend,
+                qt_headless_diff::INSERTION,
+                container_id,
+                new_ids[i],
+                i);
+            ++stats.insertions;
+        }
+    }
+
+    container.headless_children = std::move(new_ids);
+}
+
+// This is the headless counterpart of qt_layout_node::update (for containers).
 static void
-do_text_control(qt_context ctx, bidirectional<string> text)
+update_headless_container(
+    qt_headless_backend& backend,
+    alia::system* system,
+    qt_layout_container& container)
+{
+    record_layout_update(system);
+    if (container.dirty)
+    {
+        for (auto* node = container.children; node; node = node->next)
+        {
+            if (qt_layout_container* child = node->as_container())
+                update_headless_container(backend, system, *child);
+            else
+                record_layout_update(system);
+        }
+        reconcile_headless_children(backend, container);
+        container.dirty = false;
+    }
+}
+
+void
+qt_headless_backend::update(alia::system* system, qt_root_container& root)
+{
+    update_headless_container(*this, system, root);
+}
+
+void
+qt_headless_backend::record_content_change(qt_layout_node& node)
+{
+    ++content_changes;
+    record_headless_diff(
+        *this,
+        qt_headless_diff::CONTENT_CHANGE,
+        0,
+        get_headless_id(*this, node),
+        -1);
+}
+
+// Change the content of :node (e.g., a label's text). If the node has a
+// widget, :change(widget) makes the change. Otherwise, the change is just
+// reported to the backend.
+template<class Node, class Change>
+void
+change_node_content(qt_traversal& traversal, Node& node, Change&& change)
+{
+    if (node.object)
+        change(node.object.get());
+    else
+        traversal.backend->record_content_change(node);
+}
+
+// qt_widget_node is a convenience base for nodes that are represented by a
+// single Qt widget.
+struct qt_widget_node : qt_layout_node
+{
+    virtual QWidget*
+    widget()
+        = 0;
+
+    void
+    update(alia::system* system, QWidget* parent)
+    {
+        record_layout_update(system);
+        QWidget* object = this->widget();
+        if (object->parent() != parent)
+            object->setParent(parent);
+    }
+
+    QObject*
+    qt_object()
+    {
+        return this->widget();
+    }
+
+    void
+    insert_into(QBoxLayout* layout, int index)
+    {
+        layout->insertWidget(index, this->widget());
+    }
+};
+
+struct qt_label : qt_widget_node
+{
+    pooled_widget<QLabel> object;
+    captured_id text_id;
+
+    QWidget*
+    widget()
+    {
+        return object.get();
+    }
+};
+
+static std::size_t
+get_alia_heap_size(qt_label const& label)
+{
+    return get_alia_heap_size(label.object);
+}
+
+static void
+do_label(qt_context ctx, readable<string> text)
+{
+    auto& label = get_cached_data<qt_label>(ctx);
+
+    on_refresh(ctx, [&](auto ctx) {
+        auto& traversal = get_component<qt_traversal_tag>(ctx);
+
+        if (!label.object && traversal.backend->has_widgets())
+        {
+            auto* parent = traversal.active_parent;
+            label.object.acquire(traversal.widget_pool, parent);
+            if (parent->isVisible())
+                label.object->show();
+        }
+
+        add_layout_node(ctx, &label);
+
+        refresh_signal_shadow(
+            label.text_id,
+            text,
+            [&](auto const& text) {
+                change_node_content(traversal, label, [&](QLabel* object) {
+                    object->setText(text.c_str());
+                });
+            },
+            [&]() {
+                change_node_content(traversal, label, [&](QLabel* object) {
+                    object->setText("");
+                });
+            });
+    });
+}
+
+struct click_event : targeted_event
+{
+};
+
+struct qt_button : qt_widget_node, node_identity
+{
+    pooled_widget<QPushButton> object;
+    captured_id text_id;
+    routing_region_ptr route;
+
+    QWidget*
+    widget()
+    {
+        return object.get();
+    }
+};
+
+static std::size_t
+get_alia_heap_size(qt_button const& button)
+{
+    return get_alia_heap_size(button.object);
+}
+
+static void
+do_button(qt_context ctx, readable<string> text, action<> on_click)
+{
+    auto& button = get_cached_data<qt_button>(ctx);
+
+    on_refresh(ctx, [&](auto ctx) {
+        auto& system = get_component<system_tag>(ctx);
+
+        button.route = get_active_routing_region(ctx);
+
+        auto& traversal = get_component<qt_traversal_tag>(ctx);
+
+        if (!button.object && traversal.backend->has_widgets())
+        {
+            auto* parent = traversal.active_parent;
+            button.object.acquire(traversal.widget_pool, parent);
+            if (parent->isVisible())
+                button.object->show();
+            button.object.track(QObject::connect(
+                button.object.get(),
+                &QPushButton::clicked,
+                // The Qt object is technically owned within both of these, so
+                // I'm pretty sure it's safe to reference both.
+                [&system, &button]() {
+                    click_event event;
+                    dispatch_targeted_event(
+                        system, event, routable_node_id{&button, button.route});
+                }));
+        }
+
+        add_layout_node(ctx, &button);
+
+        refresh_signal_shadow(
+            button.text_id,
+            text,
+            [&](auto const& text) {
+                change_node_content(
+                    traversal, button, [&](QPushButton* object) {
+                        object->setText(text.c_str());
+                    });
+            },
+            [&]() {
+                change_node_content(
+                    traversal, button, [&](QPushButton* object) {
+                        object->setText("");
+                    });
+            });
+    });
+
+    on_targeted_event<click_event>(ctx, &button, [&](auto ctx, auto& e) {
+        if (action_is_ready(on_click))
+        {
+            perform_action(on_click);
+        }
+    });
+}
+
+struct value_update_event : targeted_event
+{
+    string value;
+};
+
+// text_commit_policy determines when the edits in a text control are written
+// back to its signal. (Pending edits are always committed when the control
+// loses focus.)
+struct text_commit_policy
+{
+    enum mode_type
+    {
+        // Commit every edit as it happens.
+        IMMEDIATE,
+        // Commit once the text has been idle for :interval milliseconds.
+        DEBOUNCED,
+        // Commit at most once every :interval milliseconds.
+        THROTTLED
+    };
+    mode_type mode;
+    millisecond_count interval;
+};
+
+inline text_commit_policy
+immediate_commit()
+{
+    return text_commit_policy{text_commit_policy::IMMEDIATE, 0};
+}
+
+inline text_commit_policy
+debounced_commit(millisecond_count interval)
+{
+    return text_commit_policy{text_commit_policy::DEBOUNCED, interval};
+}
+
+inline text_commit_policy
+throttled_commit(millisecond_count interval)
+{
+    return text_commit_policy{text_commit_policy::THROTTLED, interval};
+}
+
+// qt_event_callback_filter is a Qt event filter that invokes a callback for all
+// events of a particular type (without otherwise interfering with them).
+struct qt_event_callback_filter : QObject
+{
+    qt_event_callback_filter(QEvent::Type type, std::function<void()> callback)
+        : type(type), callback(std::move(callback))
+    {
+    }
+
+    bool
+    eventFilter(QObject*, QEvent* event) override
+    {
+        if (event->type() == type)
+            callback();
+        return false;
+    }
+
+    QEvent::Type type;
+    std::function<void()> callback;
+};
+
+struct qt_text_control : qt_widget_node, node_identity
+{
+    pooled_widget<QTextEdit> object;
+    captured_id text_id;
+    routing_region_ptr route;
+
+    text_commit_policy policy = immediate_commit();
+
+    // If edits are being held back, this is the timer that will commit them.
+    // (Its being active indicates that there are uncommitted edits.)
+    std::unique_ptr<QTimer> commit_timer;
+
+    // This commits any pending edits when the control loses focus.
+    // (Destroying it also uninstalls it.)
+    std::unique_ptr<qt_event_callback_filter> focus_filter;
+
+    // To avoid extracting (and comparing) the full text of the document just
+    // to see if it matches the signal, this records what's known about it:
+    // As long as the document's revision is still :synced_revision, its text
+    // has :synced_size and :synced_hash.
+    int synced_revision = -1;
+    size_t synced_size = 0;
+    size_t synced_hash = 0;
+
+    // This is set while we're setting the document's text ourselves (so that
+    // we don't echo it back to the signal).
+    bool setting_text = false;
+
+    QWidget*
+    widget()
+    {
+        return object.get();
+    }
+};
+
+static std::size_t
+get_alia_heap_size(qt_text_control const& text_control)
+{
+    return get_alia_heap_size(text_control.object);
+}
+
+// Record that the document in :widget currently holds :text.
+static void
+record_synced_text(qt_text_control& widget, string const& text)
+{
+    widget.synced_revision = widget.object->document()->revision();
+    widget.synced_size = text.size();
+    widget.synced_hash = std::hash<string>()(text);
+}
+
+// Set the text of :widget's document to :text (unless it's already known to
+// hold it).
+static void
+set_text_control_text(qt_text_control& widget, string const& text)
+{
+    // Prevent update cycles (and needless resets of the document).
+    if (widget.object->document()->revision() == widget.synced_revision
+        && text.size() == widget.synced_size
+        && std::hash<string>()(text) == widget.synced_hash)
+    {
+        return;
+    }
+    widget.setting_text = true;
+    widget.object->setPlainText(
+        QString::fromUtf8(text.data(), int(text.size())));
+    widget.setting_text = false;
+    record_synced_text(widget, text);
+}
+
+// Write the current text of :widget's document back to its signal.
+static void
+commit_text(alia::system& system, qt_text_control& widget)
+{
+    if (widget.commit_timer)
+        widget.commit_timer->stop();
+    value_update_event event;
+    QByteArray const utf8 = widget.object->toPlainText().toUtf8();
+    event.value.assign(utf8.constData(), size_t(utf8.size()));
+    record_synced_text(widget, event.value);
+    dispatch_targeted_event(
+        system, event, routable_node_id{&widget, widget.route});
+}
+
+static bool
+has_pending_edits(qt_text_control& widget)
+{
+    return widget.commit_timer && widget.commit_timer->isActive();
+}
+
+// Respond to an edit in :widget's document according to its commit policy.
+static void
+handle_text_edit(alia::system& system, qt_text_control& widget)
+{
+    if (widget.policy.mode == text_commit_policy::IMMEDIATE)
+    {
+        commit_text(system, widget);
+        return;
+    }
+
+    if (!widget.commit_timer)
+    {
+        widget.commit_timer.reset(new QTimer);
+        widget.commit_timer->setSingleShot(true);
+        QObject::connect(
+            widget.commit_timer.get(),
+            &QTimer::timeout,
+            [&system, &widget]() { commit_text(system, widget); });
+    }
+
+    // A debounced control restarts its timer with every edit, whereas a
+    // throttled one leaves it running.
+    if (widget.policy.mode == text_commit_policy::DEBOUNCED
+        || !widget.commit_timer->isActive())
+    {
+        widget.commit_timer->start(int(widget.policy.interval));
+    }
+}
+
+static void
+do_text_control(
+    qt_context ctx,
+    bidirectional<string> text,
+    text_commit_policy policy = immediate_commit())
 {
     auto& widget = get_cached_data<qt_text_control>(ctx);
 
@@ -298,26 +1314,31 @@ do_text_control(qt_context ctx, bidirectional<string> text)
         auto& system = get_component<system_tag>(ctx);
 
         widget.route = get_active_routing_region(ctx);
+        widget.policy = policy;
+
+        auto& traversal = get_component<qt_traversal_tag>(ctx);
 
-        if (!widget.object)
+        if (!widget.object && traversal.backend->has_widgets())
         {
-            auto& traversal = get_component<qt_traversal_tag>(ctx);
             auto* parent = traversal.active_parent;
-            widget.object.reset(new QTextEdit(parent));
+            widget.object.acquire(traversal.widget_pool, parent);
             if (parent->isVisible())
                 widget.object->show();
-            QObject::connect(
+            widget.object.track(QObject::connect(
                 widget.object.get(),
                 &QTextEdit::textChanged,
                 // The Qt object is technically owned within both of these, so
                 // I'm pretty sure it's safe to reference both.
                 [&system, &widget]() {
-                    value_update_event event;
-                    event.value
-                        = widget.object->toPlainText().toUtf8().constData();
-                    dispatch_targeted_event(
-                        system, event, routable_node_id{&widget, widget.route});
-                });
+                    if (!widget.setting_text)
+                        handle_text_edit(system, widget);
+                }));
+            widget.focus_filter.reset(new qt_event_callback_filter(
+                QEvent::FocusOut, [&system, &widget]() {
+                    if (has_pending_edits(widget))
+                        commit_text(system, widget);
+                }));
+            widget.object->installEventFilter(widget.focus_filter.get());
         }
 
         add_layout_node(ctx, &widget);
@@ -325,48 +1346,75 @@ do_text_control(qt_context ctx, bidirectional<string> text)
         refresh_signal_shadow(
             widget.text_id,
             text,
-            [&](auto text) {
-                // Prevent update cycles.
-                if (widget.object->toPlainText().toUtf8().constData() != text)
-                    widget.object->setText(text.c_str());
+            [&](auto const& text) {
+                // If the user's edits haven't been committed yet, they take
+                // precedence.
+                if (!has_pending_edits(widget))
+                {
+                    change_node_content(traversal, widget, [&](QTextEdit*) {
+                        set_text_control_text(widget, text);
+                    });
+                }
             },
             [&]() {
-                // Prevent update cycles.
-                if (widget.object->toPlainText().toUtf8().constData() != "")
-                    widget.object->setText("");
+                if (!has_pending_edits(widget))
+                {
+                    change_node_content(traversal, widget, [&](QTextEdit*) {
+                        set_text_control_text(widget, string());
+                    });
+                }
             });
     });
 
     on_targeted_event<value_update_event>(
-        ctx, &widget, [&](auto ctx, auto& e) { write_signal(text, e.value); });
+        ctx, &widget, [&](auto ctx, auto& e) {
+            write_signal(text, std::move(e.value));
+        });
 }
 
 struct qt_column : qt_layout_container
 {
     std::shared_ptr<QVBoxLayout> object;
 
+    ~qt_column()
+    {
+        // Qt deletes any layouts that are still inside a layout along with it,
+        // but our child layouts are owned by their own nodes, so take them out
+        // first.
+        if (object)
+        {
+            for (int i = object->count() - 1; i >= 0; --i)
+                remove_layout_item(object.get(), i);
+        }
+    }
+
     void
-    update(alia::system* system, QWidget* parent, QLayout* layout)
+    update(alia::system* system, QWidget* parent)
     {
+        record_layout_update(system);
         if (!object)
-            object.reset(new QVBoxLayout(parent));
-
-        if (object->parent() != parent)
-            object->setParent(parent);
-
-        layout->addItem(object.get());
+            object.reset(new QVBoxLayout);
 
         if (this->dirty)
         {
-            while (object->takeAt(0))
-                ;
             for (auto* node = children; node; node = node->next)
-            {
-                node->update(system, parent, object.get());
-            }
+                node->update(system, parent);
+            reconcile_layout(object.get(), children);
             this->dirty = false;
         }
     }
+
+    QObject*
+    qt_object()
+    {
+        return object.get();
+    }
+
+    void
+    insert_into(QBoxLayout* layout, int index)
+    {
+        layout->insertLayout(index, object.get());
+    }
 };
 
 struct column_layout : noncopyable
@@ -399,6 +1447,495 @@ struct column_layout : noncopyable
     scoped_layout_container slc_;
 };
 
+// qt_layout_span records the (contiguous) run of layout nodes that a pure
+// component (or frame region) contributed to its parent's list on its last
+// refresh, so that the same nodes can be spliced back in when it's skipped.
+struct qt_layout_span
+{
+    qt_layout_node* first = nullptr;
+    qt_layout_node* last = nullptr;
+};
+
+// Invoke :content if :invoke is true, recording the layout nodes that it adds
+// in :span. Otherwise, splice in the nodes that it added last time.
+template<class Content>
+void
+do_layout_span(
+    qt_context ctx, qt_layout_span& span, bool invoke, Content&& content)
+{
+    qt_traversal& traversal = get_component<qt_traversal_tag>(ctx);
+    bool const is_refresh = is_refresh_event(ctx);
+
+    if (invoke)
+    {
+        qt_layout_node** const start = traversal.next_ptr;
+
+        content();
+
+        if (is_refresh)
+        {
+            // Find the nodes that the content added.
+            if (traversal.next_ptr == start)
+            {
+                span.first = span.last = nullptr;
+            }
+            else
+            {
+                span.first = *start;
+                qt_layout_node* node = span.first;
+                while (&node->next != traversal.next_ptr)
+                    node = node->next;
+                span.last = node;
+            }
+        }
+    }
+    else if (is_refresh && span.first)
+    {
+        set_next_node(traversal, span.first);
+        traversal.next_ptr = &span.last->next;
+    }
+}
+
+// do_pure_component(ctx, component, args...) is the Qt version of
+// invoke_pure_component. If the component is skipped on a refresh, the layout
+// nodes that it produced last time are reused as-is.
+template<class Component, class... Args>
+void
+do_pure_component(qt_context ctx, Component&& component, Args const&... args)
+{
+    // Like the nodes it refers to, this is cached data, so if the nodes are
+    // destroyed, so is this (and the component is invoked again).
+    qt_layout_span& span = get_cached_data<qt_layout_span>(ctx);
+
+    pure_component_block block;
+    do_layout_span(
+        ctx,
+        span,
+        block.begin(ctx, combine_ids(unit_id, ref(args.value_id())...)),
+        [&] { component(ctx, args...); });
+}
+
+// do_frame_region(ctx, content) is the Qt version of invoke_frame_region. If
+// the region is skipped on an animation frame, the layout nodes that it
+// produced last time are reused as-is.
+template<class Content>
+void
+do_frame_region(qt_context ctx, Content&& content)
+{
+    // (See do_pure_component.)
+    qt_layout_span& span = get_cached_data<qt_layout_span>(ctx);
+
+    frame_region_block block;
+    do_layout_span(ctx, span, block.begin(ctx), [&] { content(ctx); });
+}
+
+// qt_scroll_list is a container for very long lists of uniformly sized rows.
+// It presents a scroll area whose content is as tall as the full list, but only
+// the rows inside the viewport (plus an overscan band) actually exist. Those
+// rows live in a single 'window' widget that's positioned where they belong
+// within the content.
+struct qt_scroll_list : qt_layout_container
+{
+    std::shared_ptr<QScrollArea> object;
+
+    // the widget that spans the full (virtual) height of the list
+    QWidget* content = nullptr;
+
+    // the widget holding the rows that actually exist, and its layout
+    QWidget* window = nullptr;
+    QVBoxLayout* window_layout = nullptr;
+
+    // the range of rows that currently exist - (See for_each_in_window.)
+    size_t window_first = 0;
+    size_t window_size = 0;
+
+    ~qt_scroll_list()
+    {
+        if (object)
+        {
+            // The rows are owned by their own nodes, so they have to escape
+            // before Qt deletes the window along with its children.
+            for (int i = window_layout->count() - 1; i >= 0; --i)
+                remove_layout_item(window_layout, i);
+            QObjectList const rows = window->children();
+            for (QObject* row : rows)
+            {
+                if (row->isWidgetType())
+                    static_cast<QWidget*>(row)->setParent(nullptr);
+            }
+        }
+    }
+
+    void
+    update(alia::system* system, QWidget* parent)
+    {
+        record_layout_update(system);
+        if (object->parent() != parent)
+            object->setParent(parent);
+
+        if (this->dirty)
+        {
+            for (auto* node = children; node; node = node->next)
+                node->update(system, window);
+            reconcile_layout(window_layout, children);
+            this->dirty = false;
+        }
+    }
+
+    QObject*
+    qt_object()
+    {
+        return object.get();
+    }
+
+    void
+    insert_into(QBoxLayout* layout, int index)
+    {
+        layout->insertWidget(index, object.get());
+    }
+};
+
+// Update the window of rows that :list instantiates to match the current
+// state of its scroll area, and size the content to match.
+//
+// The size of the window doesn't depend on the scroll position, so as the list
+// scrolls, rows are consistently recycled (rather than shuffled around).
+//
+// Qt limits widgets to QWIDGETSIZE_MAX pixels, so the content can't always be
+// as tall as the full list. When it can't, it's clamped to that limit, and the
+// scroll position is mapped proportionally onto the full list. (The rows
+// themselves are still their full height, so the scroll bar just moves faster
+// than the rows do.)
+//
+// Without widgets, there's no viewport, so the window only covers the
+// overscan rows at the top of the list.
+static void
+update_scroll_list_window(
+    qt_scroll_list& list, size_t item_count, int row_height, int overscan)
+{
+    typedef long long pixel_count;
+
+    int const viewport_height
+        = list.object ? list.object->viewport()->height() : 0;
+    int const scroll_position
+        = list.object ? list.object->verticalScrollBar()->value() : 0;
+
+    pixel_count const full_height = pixel_count(item_count) * row_height;
+    pixel_count const content_height
+        = std::min(full_height, pixel_count(QWIDGETSIZE_MAX));
+
+    // Map the scroll position onto the full list.
+    pixel_count const scroll_range = content_height - viewport_height;
+    pixel_count const full_scroll_range = full_height - viewport_height;
+    pixel_count const list_position
+        = scroll_range > 0 && full_height != content_height
+              ? scroll_position * full_scroll_range / scroll_range
+              : pixel_count(scroll_position);
+
+    size_t const window_size
+        = size_t(viewport_height / row_height + 2 + 2 * overscan);
+    size_t const first_visible = size_t(list_position / row_height);
+    size_t const last_first
+        = item_count > window_size ? item_count - window_size : 0;
+    size_t const first = std::min(
+        first_visible > size_t(overscan) ? first_visible - size_t(overscan)
+                                         : 0,
+        last_first);
+    size_t const row_count = std::min(item_count - first, window_size);
+
+    list.window_first = first;
+    list.window_size = window_size;
+
+    if (!list.object)
+        return;
+    // Place the window so that the row at :list_position appears at the top
+    // of the viewport. (Without clamping, this is just where the window's
+    // first row belongs.)
+    pixel_count const window_height = pixel_count(row_count) * row_height;
+    pixel_count const window_top = std::max(
+        std::min(
+            scroll_position
+                - (list_position - pixel_count(first) * row_height),
+            content_height - window_height),
+        pixel_count(0));
+    list.content->setFixedHeight(int(content_height));
+    list.content->layout()->setContentsMargins(0, int(window_top), 0, 0);
+    list.window->setFixedHeight(int(window_height));
+}
+
+// do_scroll_list(ctx, items, row_height, fn) presents the vector-like
+// container :items as a scrolling list. :fn(ctx, item) is invoked to present
+// each row, but only for the rows that are within :overscan rows of the
+// viewport. Each row is expected to be :row_height pixels tall. (:row_height
+// must be at least 1, and :overscan can't be negative.)
+//
+// Note that, as with for_each_in_window, the rows' data (including their
+// widgets) is recycled as the list scrolls.
+template<class ContainerSignal, class Fn>
+void
+do_scroll_list(
+    qt_context ctx,
+    ContainerSignal const& items,
+    int row_height,
+    Fn&& fn,
+    int overscan = 4)
+{
+    // The window calculations divide by the row height, so in release builds,
+    // bad values are clamped rather than left to crash.
+    assert(row_height >= 1 && overscan >= 0);
+    row_height = std::max(row_height, 1);
+    overscan = std::max(overscan, 0);
+
+    qt_scroll_list* list;
+    get_cached_data(ctx, &list);
+
+    qt_traversal* traversal = nullptr;
+    QWidget* outer_parent = nullptr;
+
+    on_refresh(ctx, [&](auto ctx) {
+        auto& system = get_component<system_tag>(ctx);
+
+        traversal = &get_component<qt_traversal_tag>(ctx);
+        outer_parent = traversal->active_parent;
+
+        if (!list->object && traversal->backend->has_widgets())
+        {
+            list->object.reset(new QScrollArea(outer_parent));
+            list->object->setWidgetResizable(true);
+            list->content = new QWidget;
+            auto* content_layout = new QVBoxLayout(list->content);
+            content_layout->setSpacing(0);
+            list->window = new QWidget(list->content);
+            content_layout->addWidget(list->window);
+            content_layout->addStretch();
+            list->window_layout = new QVBoxLayout(list->window);
+            list->window_layout->setContentsMargins(0, 0, 0, 0);
+            list->window_layout->setSpacing(0);
+            list->object->setWidget(list->content);
+            if (outer_parent->isVisible())
+                list->object->show();
+            // Scrolling or resizing the viewport changes which rows should
+            // exist.
+            auto* scroll_bar = list->object->verticalScrollBar();
+            QObject::connect(
+                scroll_bar, &QScrollBar::valueChanged, [&system](int) {
+                    schedule_refresh(system);
+                });
+            QObject::connect(
+                scroll_bar, &QScrollBar::rangeChanged, [&system](int, int) {
+                    schedule_refresh(system);
+                });
+        }
+
+        // The window is only ever updated on refresh passes, so that other
+        // events see the same rows that the last refresh did.
+        update_scroll_list_window(
+            *list,
+            signal_has_value(items) ? read_signal(items).size() : 0,
+            row_height,
+            overscan);
+    });
+
+    scoped_layout_container slc(ctx, list);
+    if (traversal)
+        traversal->active_parent = list->window;
+
+    for_each_in_window(
+        ctx,
+        items,
+        list->window_first,
+        list->window_size,
+        std::forward<Fn>(fn));
+
+    slc.end();
+    if (traversal)
+        traversal->active_parent = outer_parent;
+}
+
+// Decide whether or not the content of :container should be instantiated,
+// given whether or not the container is currently :shown. This is what
+// implements lazy content (see qt_layout_container::lazy).
+static bool
+update_lazy_content(qt_context ctx, qt_layout_container& container, bool shown)
+{
+    on_refresh(ctx, [&](auto ctx) {
+        if (!container.lazy || shown)
+        {
+            container.content_active = true;
+            container.releasing = false;
+            if (container.release_timer)
+                container.release_timer->stop();
+            return;
+        }
+        if (!container.content_active || container.release_delay == 0)
+            return;
+
+        millisecond_count now = get_component<timing_tag>(ctx).tick_counter;
+        if (!container.releasing)
+        {
+            container.releasing = true;
+            container.hidden_since = now;
+        }
+        int remaining
+            = int(container.hidden_since + container.release_delay - now);
+        if (remaining <= 0)
+        {
+            container.content_active = false;
+            container.releasing = false;
+            return;
+        }
+        // Come back when it's time to release the content.
+        if (!container.release_timer)
+        {
+            auto& system = get_component<system_tag>(ctx);
+            container.release_timer.reset(new QTimer);
+            container.release_timer->setSingleShot(true);
+            QObject::connect(
+                container.release_timer.get(),
+                &QTimer::timeout,
+                [&system]() { schedule_refresh(system); });
+        }
+        if (!container.release_timer->isActive())
+            container.release_timer->start(remaining);
+    });
+    return container.content_active;
+}
+
+// qt_panel is a container whose content can be shown or hidden. The panel's
+// own widget stays in its parent's layout either way, but it collapses to
+// nothing while the content is hidden.
+struct qt_panel : qt_layout_container
+{
+    std::shared_ptr<QWidget> object;
+
+    // the widget that holds the content, and its layout
+    QWidget* content = nullptr;
+    QVBoxLayout* content_layout = nullptr;
+
+    ~qt_panel()
+    {
+        if (object)
+        {
+            // The content is owned by its own nodes, so it has to escape
+            // before Qt deletes it along with the panel.
+            for (int i = content_layout->count() - 1; i >= 0; --i)
+                remove_layout_item(content_layout, i);
+            QObjectList const children = content->children();
+            for (QObject* child : children)
+            {
+                if (child->isWidgetType())
+                    static_cast<QWidget*>(child)->setParent(nullptr);
+            }
+        }
+    }
+
+    void
+    update(alia::system* system, QWidget* parent)
+    {
+        record_layout_update(system);
+        if (object->parent() != parent)
+            object->setParent(parent);
+
+        if (this->dirty)
+        {
+            for (auto* node = children; node; node = node->next)
+                node->update(system, content);
+            reconcile_layout(content_layout, children);
+            this->dirty = false;
+        }
+    }
+
+    QObject*
+    qt_object()
+    {
+        return object.get();
+    }
+
+    void
+    insert_into(QBoxLayout* layout, int index)
+    {
+        layout->insertWidget(index, object.get());
+    }
+};
+
+// lazy_content(value, release_delay) specifies whether or not a container's
+// content is lazy. (See qt_layout_container::lazy.) It has its own structure
+// to make it obvious at the call site.
+struct lazy_content
+{
+    explicit lazy_content(bool value, millisecond_count release_delay = 0)
+        : value(value), release_delay(release_delay)
+    {
+    }
+    bool value;
+    millisecond_count release_delay;
+};
+
+// do_panel(ctx, shown, fn) presents the content produced by :fn(ctx) in a
+// panel that's only shown while :shown is true.
+//
+// By default, the content is always there (just hidden). If :lazy is given,
+// the content isn't created until the panel is first shown, and it can be
+// released again after the panel has been hidden for a while. (Only the
+// content's cached data is released. Its state persists.)
+//
+// The content is a frame region (see do_frame_region), so animation frames
+// skip it unless something within it is animating.
+template<class Fn>
+void
+do_panel(
+    qt_context ctx,
+    readable<bool> shown,
+    Fn&& fn,
+    lazy_content lazy = lazy_content(false))
+{
+    qt_panel* panel;
+    get_cached_data(ctx, &panel);
+
+    qt_traversal* traversal = nullptr;
+    QWidget* outer_parent = nullptr;
+    bool is_shown = signal_has_value(shown) && read_signal(shown);
+
+    on_refresh(ctx, [&](auto ctx) {
+        traversal = &get_component<qt_traversal_tag>(ctx);
+        outer_parent = traversal->active_parent;
+
+        if (!panel->object && traversal->backend->has_widgets())
+        {
+            panel->object.reset(new QWidget(outer_parent));
+            auto* panel_layout = new QVBoxLayout(panel->object.get());
+            panel_layout->setContentsMargins(0, 0, 0, 0);
+            panel->content = new QWidget(panel->object.get());
+            panel_layout->addWidget(panel->content);
+            panel->content_layout = new QVBoxLayout(panel->content);
+            panel->content_layout->setContentsMargins(0, 0, 0, 0);
+            if (outer_parent->isVisible())
+                panel->object->show();
+        }
+
+        panel->lazy = lazy.value;
+        panel->release_delay = lazy.release_delay;
+        if (panel->content && panel->content->isHidden() == is_shown)
+            panel->content->setVisible(is_shown);
+    });
+
+    bool const content_active = update_lazy_content(ctx, *panel, is_shown);
+
+    scoped_layout_container slc(ctx, panel);
+    if (traversal)
+        traversal->active_parent = panel->content;
+
+    ALIA_IF(content_active)
+    {
+        do_frame_region(ctx, fn);
+    }
+    ALIA_END
+
+    slc.end();
+    if (traversal)
+        traversal->active_parent = outer_parent;
+}
+
 void
 qt_system::operator()(alia::context vanilla_ctx)
 {
@@ -406,40 +1943,238 @@ qt_system::operator()(alia::context vanilla_ctx)
     qt_context ctx = extend_context<qt_traversal_tag>(vanilla_ctx, traversal);
 
     on_refresh(ctx, [&](auto ctx) {
-        traversal.next_ptr = &this->root;
+        traversal.widget_pool = this->widget_pool;
+        traversal.backend = this->backend.get();
+        traversal.next_ptr = &this->root.children;
         traversal.active_parent = this->window;
+        traversal.active_container = &this->root;
     });
 
     this->controller(ctx);
 
     on_refresh(ctx, [&](auto ctx) {
-        while (this->layout->takeAt(0))
-            ;
-        this->root->update(this->system, this->window, this->layout);
+        // Terminate the top-level list of nodes, just as
+        // scoped_layout_container does for the lists inside containers.
+        set_next_node(traversal, nullptr);
+        // If nothing recorded a change, the presentation is already
+        // up-to-date.
+        if (this->root.dirty)
+        {
+            scoped_profiling_span span;
+            span.begin(this->system->profiler, "layout update", "qt");
+            this->backend->update(this->system, this->root);
+        }
+        // If this refresh left anything for the GC, get it started.
+        if (this->gc_timer && !this->system->data.dead_named_blocks.empty()
+            && !this->gc_timer->isActive())
+        {
+            this->gc_timer->start();
+        }
     });
 }
 
+void
+initialize(qt_external_interface& external, alia::system& system)
+{
+    external.system = &system;
+    external.timer = new QTimer;
+    external.timer->setSingleShot(true);
+    QObject::connect(external.timer, &QTimer::timeout, [&external]() {
+        alia::system& system = *external.system;
+        if (system_needs_refresh(system))
+            refresh_system(system);
+    });
+
+    qt_frame_clock& clock = external.frame_clock;
+    if (QScreen* screen = QGuiApplication::primaryScreen())
+    {
+        double rate = screen->refreshRate();
+        if (rate > 0)
+            clock.frame_interval = std::max(1000 / rate, 1.0);
+    }
+    clock.timer = new QTimer;
+    clock.timer->setSingleShot(true);
+    clock.timer->setTimerType(Qt::PreciseTimer);
+    QObject::connect(clock.timer, &QTimer::timeout, [&external]() {
+        qt_frame_clock& clock = external.frame_clock;
+        millisecond_count now = get_default_tick_count();
+        clock.frame_time = millisecond_count(
+            std::floor(now / clock.frame_interval) * clock.frame_interval);
+        ++clock.frame_count;
+        // Anything that's still animating requests the next frame during this
+        // one. If nothing does, the animation is over.
+        alia::system& system = *external.system;
+        if (system_needs_refresh(system))
+        {
+            clock.in_frame = true;
+            refresh_animation_frame(system);
+            clock.in_frame = false;
+        }
+    });
+
+    system.external = &external;
+}
+
+void
+qt_external_interface::request_animation_refresh()
+{
+    // Requests that are made before the next frame are all covered by it.
+    if (frame_clock.timer->isActive())
+        return;
+    // Aim for the next point on the frame grid. QTimer only deals in whole
+    // milliseconds, so this rounds up to keep the timer from firing within
+    // the current frame.
+    double now = get_default_tick_count();
+    double interval = frame_clock.frame_interval;
+    double next_frame = (std::floor(now / interval) + 1) * interval;
+    frame_clock.timer->start(int(std::ceil(next_frame - now)));
+}
+
+bool
+qt_external_interface::schedule_refresh()
+{
+    // Refreshes requested in response to events don't wait for the next
+    // frame.
+    if (!timer->isActive())
+        timer->start(0);
+    return true;
+}
+
+void
+qt_external_interface::schedule_refresh_from_any_thread()
+{
+    // :timer lives on the GUI thread, so this queues the request there.
+    QMetaObject::invokeMethod(
+        timer,
+        [this]() {
+            system->refresh_needed = true;
+            schedule_refresh();
+        },
+        Qt::QueuedConnection);
+}
+
+millisecond_count
+qt_external_interface::get_tick_count() const
+{
+    millisecond_count now
+        = frame_clock.in_frame ? frame_clock.frame_time
+                               : get_default_tick_count();
+    // Since frame times are snapped to the frame grid, they can be slightly
+    // behind the time that an earlier (event-driven) refresh saw.
+    if (int(now - last_tick) > 0)
+        last_tick = now;
+    return last_tick;
+}
+
+// Initialize :qt_system to present the UI that :controller produces, driven
+// by :alia_system. The UI is presented through :backend. If that's omitted,
+// it's presented through Qt widgets. Either way, if the backend has widgets,
+// they're placed inside a new top-level window (qt_system.window), which is
+// also given to the backend if it's a qt_widget_backend.
+//
+// (Even a backend without widgets still needs a QCoreApplication, since
+// refreshes are scheduled through Qt timers.)
 void
 initialize(
     qt_system& qt_system,
     alia::system& alia_system,
-    std::function<void(qt_context)> controller)
+    std::function<void(qt_context)> controller,
+    std::unique_ptr<qt_layout_backend> backend = nullptr)
 {
+    auto phase_start = std::chrono::steady_clock::now();
+    // Get the time since :phase_start (in microseconds) and start the next
+    // phase.
+    auto end_phase = [&]() {
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::duration<double, std::micro> elapsed = now - phase_start;
+        phase_start = now;
+        return elapsed.count();
+    };
+    qt_startup_timings& timings = qt_system.startup_timings;
+
     // Initialize the Qt system.
     qt_system.system = &alia_system;
-    qt_system.root = 0;
-    qt_system.window = new QWidget;
-    qt_system.layout = new QVBoxLayout(qt_system.window);
-    qt_system.window->setLayout(qt_system.layout);
+    if (!backend)
+        backend.reset(new qt_widget_backend);
+    if (backend->has_widgets())
+    {
+        qt_system.window = new QWidget;
+        qt_system.layout = new QVBoxLayout(qt_system.window);
+        qt_system.window->setLayout(qt_system.layout);
+        qt_system.root.layout = qt_system.layout;
+        if (auto* widget_backend
+            = dynamic_cast<qt_widget_backend*>(backend.get()))
+        {
+            widget_backend->window = qt_system.window;
+        }
+    }
+    qt_system.backend = std::move(backend);
 
     // Hook up the Qt system to the alia system.
+    enable_data_pool(alia_system.data);
     alia_system.controller = std::ref(qt_system);
     qt_system.controller = std::move(controller);
-
-    // Do the initial refresh.
+    initialize(qt_system.external, alia_system);
+    // Since Qt can get us back onto the GUI thread, async launchers are free
+    // to report results from other threads.
+    alia_system.thread_safe_async = true;
+    timings.setup = end_phase();
+
+    // Do the initial refresh. Since the window hasn't been shown yet, the
+    // widgets are all built offscreen, and with the window's updates
+    // suspended, Qt doesn't do any layout or painting work until the whole
+    // tree is in place.
+    if (qt_system.window)
+        qt_system.window->setUpdatesEnabled(false);
     refresh_system(alia_system);
+    timings.initial_build = end_phase();
+
+    // If the initial refresh changed anything that it depends on, it has to
+    // be redone before the UI is shown. This is still part of the suspended
+    // build, so whatever it changes is laid out along with everything else.
+    if (system_needs_refresh(alia_system))
+        refresh_system(alia_system);
+    timings.follow_up_refresh = end_phase();
+
+    if (qt_system.window)
+    {
+        qt_system.layout->activate();
+        qt_system.window->setUpdatesEnabled(true);
+    }
+    timings.layout = end_phase();
 }
 
+// Switch :qt_system over to incremental garbage collection. Parts of the UI
+// that disappear (e.g., the items of a list that's been cleared) are then
+// destroyed from an idle handler, spending at most :budget per pass, rather
+// than all at once in the refresh where they disappeared.
+void
+enable_incremental_gc(qt_system& qt_system, std::chrono::microseconds budget)
+{
+    qt_system.gc_budget = budget;
+    qt_system.system->data.incremental_gc = true;
+    if (!qt_system.gc_timer)
+    {
+        // A zero-interval timer fires whenever Qt runs out of other events
+        // to process.
+        qt_system.gc_timer = new QTimer;
+        qt_system.gc_timer->setInterval(0);
+        QObject::connect(qt_system.gc_timer, &QTimer::timeout, [&qt_system]() {
+            if (collect_dead_named_blocks(
+                    qt_system.system->data, qt_system.gc_budget)
+                == 0)
+            {
+                qt_system.gc_timer->stop();
+            }
+        });
+    }
+}
+
+// Everything from here on is the demo application. Defining QT_FUN_NO_APP
+// leaves it out, so that the adaptor above can be used elsewhere (e.g., by
+// the Qt benchmarks).
+#ifndef QT_FUN_NO_APP
+
 void
 do_app_ui(qt_context ctx);
 
@@ -451,14 +2186,107 @@ main(int argc, char* argv[])
 {
     QApplication app(argc, argv);
 
-    initialize(the_qt, the_system, do_app_ui);
+    // If QT_FUN_TRACE is set, profile the UI and write a Chrome trace to the
+    // file that it names on exit.
+    traversal_profiler profiler;
+    QByteArray const trace_path = qgetenv("QT_FUN_TRACE");
+    if (!trace_path.isEmpty())
+        the_system.profiler = &profiler;
+
+    // If QT_FUN_SNAPSHOT is set, the UI's persistent state is seeded from the
+    // file that it names (if that exists) and saved back to it on exit.
+    state_snapshot snapshot;
+    QByteArray const snapshot_path = qgetenv("QT_FUN_SNAPSHOT");
+    QFile snapshot_file(QString::fromUtf8(snapshot_path.constData()));
+    uchar* snapshot_data = nullptr;
+    if (!snapshot_path.isEmpty())
+    {
+        the_system.snapshot = &snapshot;
+        // The file is memory-mapped, so only the values that are actually
+        // used get read in.
+        if (snapshot_file.open(QIODevice::ReadOnly))
+        {
+            snapshot_data = snapshot_file.map(0, snapshot_file.size());
+            if (snapshot_data)
+            {
+                load_snapshot(
+                    snapshot,
+                    reinterpret_cast<char const*>(snapshot_data),
+                    size_t(snapshot_file.size()));
+            }
+        }
+    }
 
-    refresh_system(the_system);
+    initialize(the_qt, the_system, do_app_ui);
+    // Tear down discarded parts of the UI a few milliseconds at a time.
+    enable_incremental_gc(the_qt, std::chrono::milliseconds(4));
 
     the_qt.window->setWindowTitle("alia Qt");
+    auto show_start = std::chrono::steady_clock::now();
     the_qt.window->show();
+    std::chrono::duration<double, std::micro> show_time
+        = std::chrono::steady_clock::now() - show_start;
+    the_qt.startup_timings.show = show_time.count();
+
+    // If QT_FUN_STARTUP_TIMINGS is set, report how long startup took.
+    if (qEnvironmentVariableIsSet("QT_FUN_STARTUP_TIMINGS"))
+    {
+        qt_startup_timings const& timings = the_qt.startup_timings;
+        std::fprintf(
+            stderr,
+            "startup (us): setup %.0f, initial build %.0f, follow-up "
+            "refresh %.0f, layout %.0f, show %.0f\n",
+            timings.setup,
+            timings.initial_build,
+            timings.follow_up_refresh,
+            timings.layout,
+            timings.show);
+    }
+
+    int result = app.exec();
+
+    if (the_system.profiler)
+    {
+        std::ofstream trace(trace_path.constData());
+        write_chrome_trace(trace, profiler);
+        the_system.profiler = nullptr;
+    }
+
+    if (the_system.snapshot)
+    {
+        std::string bytes;
+        write_snapshot(snapshot, bytes);
+        // The loaded values point into the mapping, so they have to be let go
+        // before the file can be rewritten.
+        clear_loaded_snapshot(snapshot);
+        if (snapshot_data)
+            snapshot_file.unmap(snapshot_data);
+        snapshot_file.close();
+        std::ofstream out(snapshot_path.constData(), std::ios::binary);
+        out.write(bytes.data(), std::streamsize(bytes.size()));
+    }
 
-    return app.exec();
+    return result;
+}
+
+// This panel only depends on its argument and its own internal state, so it's
+// invoked as a pure component, and toggling it doesn't require the rest of the
+// UI to be regenerated (and vice versa).
+static void
+do_secret_panel(qt_context ctx, readable<string> title)
+{
+    column_layout column(ctx);
+
+    do_label(ctx, title);
+
+    auto state = get_state(ctx, false);
+    ALIA_IF(state)
+    {
+        do_label(ctx, value("Another secret message!"));
+    }
+    ALIA_END
+
+    do_button(ctx, value("Toggle!"), toggle(state));
 }
 
 void
@@ -468,12 +2296,30 @@ do_app_ui(qt_context ctx)
 
     do_label(ctx, value("Hello, World!"));
 
-    auto x = get_state(ctx, string());
-    do_text_control(ctx, x);
+    // The text is persisted across runs (if there's a snapshot).
+    auto x = get_persistent_state(ctx, "text", string());
     do_text_control(ctx, x);
+    do_text_control(ctx, x, debounced_commit(300));
 
     do_label(ctx, x);
 
+    // A summary of the text is computed in the background. It's persisted
+    // too, so a warm start shows the last one right away. (The text is
+    // identified by its content so that the summary can be matched up with it
+    // across runs.)
+    auto text = identify_by_hash(ctx, x);
+    auto summary = persist_async_result(
+        ctx,
+        "summary",
+        async_in_pool(
+            ctx,
+            [](async_cancellation_token const&, string const& text) {
+                return std::to_string(text.size()) + " characters";
+            },
+            text),
+        text);
+    do_label(ctx, summary);
+
     auto state = get_state(ctx, true);
     ALIA_IF(state)
     {
@@ -483,4 +2329,35 @@ do_app_ui(qt_context ctx)
 
     do_button(ctx, x, toggle(state));
     do_button(ctx, value("Toggle!"), toggle(state));
+
+    do_pure_component(ctx, do_secret_panel, value("Independent panel"));
+
+    // The details panel is lazy, so its widgets aren't created until it's
+    // first shown, and they're released once it's been hidden for a while.
+    auto details_shown = get_state(ctx, false);
+    do_button(ctx, value("Details"), toggle(details_shown));
+    do_panel(
+        ctx,
+        details_shown,
+        [](qt_context ctx) {
+            for (int i = 0; i != 20; ++i)
+                do_label(ctx, value("detail " + std::to_string(i)));
+        },
+        lazy_content(true, 10000));
+
+    static std::vector<string> const log_lines = [] {
+        std::vector<string> lines;
+        for (int i = 0; i != 100000; ++i)
+            lines.push_back("log line " + std::to_string(i));
+        return lines;
+    }();
+    // The log never changes, so it can be identified by a constant version
+    // rather than by (a copy of) all of its lines.
+    auto log = identify_by_version(direct(log_lines), counter_type(1));
+    scoped_profiling_span log_span(ctx, "log list");
+    do_scroll_list(ctx, log, 24, [](qt_context ctx, auto line) {
+        do_label(ctx, line);
+    });
 }
+
+#endif